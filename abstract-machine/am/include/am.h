@@ -52,6 +52,7 @@ void     halt        (int code) __attribute__((__noreturn__));
 bool     ioe_init    (void);
 void     ioe_read    (int reg, void *buf);
 void     ioe_write   (int reg, void *buf);
+void     ioe_readv   (int n, const int *regs, void **bufs);
 #include "amdev.h"
 
 // ---------- CTE: Interrupt Handling and Context Switching ----------
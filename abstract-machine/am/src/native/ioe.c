@@ -77,3 +77,7 @@ static void do_io(int reg, void *buf) {
 
 void ioe_read (int reg, void *buf) { do_io(reg, buf); }
 void ioe_write(int reg, void *buf) { do_io(reg, buf); }
+
+void ioe_readv(int n, const int *regs, void **bufs) {
+  for (int i = 0; i < n; i ++) ioe_read(regs[i], bufs[i]);
+}
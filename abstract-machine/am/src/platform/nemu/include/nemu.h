@@ -32,8 +32,11 @@
 #define VGACTL_ADDR     (DEVICE_BASE + 0x0000100)
 #define AUDIO_ADDR      (DEVICE_BASE + 0x0000200)
 #define DISK_ADDR       (DEVICE_BASE + 0x0000300)
+#define IOSNAP_ADDR     (DEVICE_BASE + 0x0000400)
 #define FB_ADDR         (MMIO_BASE   + 0x1000000)
 #define AUDIO_SBUF_ADDR (MMIO_BASE   + 0x1200000)
+#define VIRTIO_BLK_ADDR     (MMIO_BASE + 0x0001000)
+#define VIRTIO_CONSOLE_ADDR (MMIO_BASE + 0x0001200)
 
 extern char _pmem_start;
 #define PMEM_SIZE (128 * 1024 * 1024)
@@ -41,7 +44,8 @@ extern char _pmem_start;
 #define NEMU_PADDR_SPACE \
   RANGE(&_pmem_start, PMEM_END), \
   RANGE(FB_ADDR, FB_ADDR + 0x200000), \
-  RANGE(MMIO_BASE, MMIO_BASE + 0x1000) /* serial, rtc, screen, keyboard */
+  RANGE(MMIO_BASE, MMIO_BASE + 0x1000), /* serial, rtc, screen, keyboard */ \
+  RANGE(VIRTIO_BLK_ADDR, VIRTIO_CONSOLE_ADDR + 0x200)
 
 typedef uintptr_t PTE;
 
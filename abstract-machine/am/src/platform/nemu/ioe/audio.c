@@ -8,19 +8,62 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+// The stream buffer is a ring. We are the only producer, so we keep
+// the write pointer here and commit new data by writing its length
+// to the count register. Reading the count register returns the
+// number of bytes which are not yet played.
+static uint32_t sbuf_size = 0;
+static uint32_t wptr = 0;
+
 void __am_audio_init() {
+  sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = sbuf_size;
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
+  wptr = 0;
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
+}
+
+// Every access to the stream buffer traps into NEMU, so the data is
+// stored a word at a time where the buffer is aligned.
+static void sbuf_write(const uint8_t *buf, uint32_t n) {
+  while (n > 0) {
+    uint32_t m = (n < sbuf_size - wptr ? n : sbuf_size - wptr);
+    uintptr_t dst = AUDIO_SBUF_ADDR + wptr;
+    uint32_t i = 0;
+    for (; i < m && ((dst + i) & 0x3); i ++) outb(dst + i, buf[i]);
+    for (; i + 4 <= m; i += 4) {
+      outl(dst + i, buf[i] | (buf[i + 1] << 8) | (buf[i + 2] << 16) | ((uint32_t)buf[i + 3] << 24));
+    }
+    for (; i < m; i ++) outb(dst + i, buf[i]);
+    wptr = (wptr + m == sbuf_size ? 0 : wptr + m);
+    buf += m;
+    n -= m;
+  }
 }
 
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *buf = ctl->buf.start;
+  uint32_t len = (uint8_t *)ctl->buf.end - buf;
+  while (len > 0) {
+    uint32_t space = sbuf_size - inl(AUDIO_COUNT_ADDR);
+    uint32_t n = (len < space ? len : space);
+    sbuf_write(buf, n);
+    // the tail only moves once for all the data that fits
+    if (n > 0) outl(AUDIO_COUNT_ADDR, n);
+    buf += n;
+    len -= n;
+  }
 }
@@ -1,12 +1,37 @@
 #include <am.h>
 #include <nemu.h>
 
+#define DISK_PRESENT_ADDR (DISK_ADDR + 0x00)
+#define DISK_BLKSZ_ADDR   (DISK_ADDR + 0x04)
+#define DISK_BLKCNT_ADDR  (DISK_ADDR + 0x08)
+#define DISK_BLKNO_ADDR   (DISK_ADDR + 0x0c)
+#define DISK_COUNT_ADDR   (DISK_ADDR + 0x10)
+#define DISK_BUF_ADDR     (DISK_ADDR + 0x14)
+#define DISK_CMD_ADDR     (DISK_ADDR + 0x18)
+
+#define DISK_CMD_READ  0
+#define DISK_CMD_WRITE 1
+
+bool __am_virtio_blk_present();
+void __am_virtio_blk_config(AM_DISK_CONFIG_T *cfg);
+void __am_virtio_blk_blkio(AM_DISK_BLKIO_T *io);
+
 void __am_disk_config(AM_DISK_CONFIG_T *cfg) {
-  cfg->present = false;
+  if (__am_virtio_blk_present()) { __am_virtio_blk_config(cfg); return; }
+  cfg->present = inl(DISK_PRESENT_ADDR);
+  cfg->blksz = inl(DISK_BLKSZ_ADDR);
+  cfg->blkcnt = inl(DISK_BLKCNT_ADDR);
 }
 
 void __am_disk_status(AM_DISK_STATUS_T *stat) {
+  stat->ready = true;
 }
 
 void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
+  if (__am_virtio_blk_present()) { __am_virtio_blk_blkio(io); return; }
+  // the whole request is done by the device with a single command
+  outl(DISK_BLKNO_ADDR, io->blkno);
+  outl(DISK_COUNT_ADDR, io->blkcnt);
+  outl(DISK_BUF_ADDR, (uintptr_t)io->buf);
+  outl(DISK_CMD_ADDR, io->write ? DISK_CMD_WRITE : DISK_CMD_READ);
 }
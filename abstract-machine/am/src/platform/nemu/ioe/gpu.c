@@ -1,20 +1,61 @@
 #include <am.h>
 #include <nemu.h>
 
-#define SYNC_ADDR (VGACTL_ADDR + 4)
+#define SYNC_ADDR      (VGACTL_ADDR + 4)
+#define CMDQ_ADDR      (VGACTL_ADDR + 8)
+#define CMDQ_LEN_ADDR  (VGACTL_ADDR + 12)
+#define CMDQ_HEAD_ADDR (VGACTL_ADDR + 16)
+#define CMDQ_TAIL_ADDR (VGACTL_ADDR + 20)
+
+#define GPU_CMD_FILL 1
+#define GPU_CMD_COPY 2
+#define GPU_CMD_BLIT 3
+
+#define CMDQ_LEN 16
+
+// Drawing is done by the device: a command is put into the ring and
+// the new tail is written, then NEMU copies the whole rectangle on the
+// host instead of the guest storing every pixel to vmem.
+typedef struct {
+  uint32_t op;
+  int32_t x, y, w, h;
+  uint32_t arg[3];
+} gpu_cmd_t;
+
+static gpu_cmd_t cmdq[CMDQ_LEN];
+static uint32_t tail = 0;
+static int width = 0, height = 0;
 
 void __am_gpu_init() {
+  uint32_t size = inl(VGACTL_ADDR);
+  width = size >> 16;
+  height = size & 0xffff;
+  outl(CMDQ_ADDR, (uintptr_t)cmdq);
+  outl(CMDQ_LEN_ADDR, CMDQ_LEN);
+  tail = inl(CMDQ_HEAD_ADDR);
+  outl(CMDQ_TAIL_ADDR, tail);
+}
+
+static void gpu_submit(uint32_t op, int x, int y, int w, int h, uint32_t a0, uint32_t a1) {
+  while (tail - inl(CMDQ_HEAD_ADDR) == CMDQ_LEN) ; // the ring is full
+  cmdq[tail % CMDQ_LEN] = (gpu_cmd_t) { .op = op, .x = x, .y = y, .w = w, .h = h, .arg = { a0, a1 } };
+  tail ++;
+  outl(CMDQ_TAIL_ADDR, tail);
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
-    .width = 0, .height = 0,
-    .vmemsz = 0
+    .present = true, .has_accel = true,
+    .width = width, .height = height,
+    .vmemsz = width * height * sizeof(uint32_t)
   };
 }
 
 void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
+  // the device is done with the pixels when the write returns
+  if (ctl->w > 0 && ctl->h > 0) {
+    gpu_submit(GPU_CMD_BLIT, ctl->x, ctl->y, ctl->w, ctl->h, (uintptr_t)ctl->pixels, ctl->w);
+  }
   if (ctl->sync) {
     outl(SYNC_ADDR, 1);
   }
@@ -1,4 +1,5 @@
 #include <am.h>
+#include <nemu.h>
 #include <klib-macros.h>
 
 void __am_timer_init();
@@ -17,10 +18,12 @@ void __am_audio_play(AM_AUDIO_PLAY_T *);
 void __am_disk_config(AM_DISK_CONFIG_T *cfg);
 void __am_disk_status(AM_DISK_STATUS_T *stat);
 void __am_disk_blkio(AM_DISK_BLKIO_T *io);
+void __am_virtio_init();
+void __am_uart_config(AM_UART_CONFIG_T *cfg);
+void __am_uart_tx(AM_UART_TX_T *tx);
 
 static void __am_timer_config(AM_TIMER_CONFIG_T *cfg) { cfg->present = true; cfg->has_rtc = true; }
 static void __am_input_config(AM_INPUT_CONFIG_T *cfg) { cfg->present = true;  }
-static void __am_uart_config(AM_UART_CONFIG_T *cfg)   { cfg->present = false; }
 static void __am_net_config (AM_NET_CONFIG_T *cfg)    { cfg->present = false; }
 
 typedef void (*handler_t)(void *buf);
@@ -34,6 +37,7 @@ static void *lut[128] = {
   [AM_GPU_FBDRAW  ] = __am_gpu_fbdraw,
   [AM_GPU_STATUS  ] = __am_gpu_status,
   [AM_UART_CONFIG ] = __am_uart_config,
+  [AM_UART_TX     ] = __am_uart_tx,
   [AM_AUDIO_CONFIG] = __am_audio_config,
   [AM_AUDIO_CTRL  ] = __am_audio_ctrl,
   [AM_AUDIO_STATUS] = __am_audio_status,
@@ -46,14 +50,72 @@ static void *lut[128] = {
 
 static void fail(void *buf) { panic("access nonexist register"); }
 
+// The snapshot device is only used when built with NEMU_IOSNAP=1, since
+// an access to a missing device is fatal in NEMU.
+#ifdef NEMU_IOSNAP
+#define SNAP_ADDR_ADDR (IOSNAP_ADDR + 0)
+#define SNAP_CMD_ADDR  (IOSNAP_ADDR + 4)
+
+#define SNAP_UPTIME 0x1
+#define SNAP_KEY    0x2
+#define SNAP_GPU    0x4
+
+#define KEYDOWN_MASK 0x8000
+
+static struct {
+  uint64_t uptime;
+  uint32_t key;
+  uint32_t gpu_ready;
+} snap;
+#endif
+
 bool ioe_init() {
   for (int i = 0; i < LENGTH(lut); i++)
     if (!lut[i]) lut[i] = fail;
   __am_gpu_init();
   __am_timer_init();
   __am_audio_init();
+#ifdef NEMU_IOSNAP
+  outl(SNAP_ADDR_ADDR, (uintptr_t)&snap);
+#endif
+#ifdef NEMU_VIRTIO
+  __am_virtio_init();
+#endif
   return true;
 }
 
 void ioe_read (int reg, void *buf) { ((handler_t)lut[reg])(buf); }
 void ioe_write(int reg, void *buf) { ((handler_t)lut[reg])(buf); }
+
+// Read a vector of registers. Those served by the snapshot device are
+// fetched together with one access; each of them should appear at most
+// once in a batch. The others are read one by one as usual.
+void ioe_readv(int n, const int *regs, void **bufs) {
+#ifdef NEMU_IOSNAP
+  uint32_t mask = 0;
+  for (int i = 0; i < n; i ++) {
+    switch (regs[i]) {
+      case AM_TIMER_UPTIME: mask |= SNAP_UPTIME; break;
+      case AM_INPUT_KEYBRD: mask |= SNAP_KEY; break;
+      case AM_GPU_STATUS:   mask |= SNAP_GPU; break;
+    }
+  }
+  if (mask != 0) outl(SNAP_CMD_ADDR, mask);
+
+  for (int i = 0; i < n; i ++) {
+    switch (regs[i]) {
+      case AM_TIMER_UPTIME: ((AM_TIMER_UPTIME_T *)bufs[i])->us = snap.uptime; break;
+      case AM_INPUT_KEYBRD: {
+        AM_INPUT_KEYBRD_T *kbd = bufs[i];
+        kbd->keydown = (snap.key & KEYDOWN_MASK) != 0;
+        kbd->keycode = snap.key & ~KEYDOWN_MASK;
+        break;
+      }
+      case AM_GPU_STATUS: ((AM_GPU_STATUS_T *)bufs[i])->ready = snap.gpu_ready; break;
+      default: ioe_read(regs[i], bufs[i]);
+    }
+  }
+#else
+  for (int i = 0; i < n; i ++) ioe_read(regs[i], bufs[i]);
+#endif
+}
@@ -0,0 +1,173 @@
+#include <am.h>
+#include <nemu.h>
+#include <klib.h>
+
+// Driver for the virtio-mmio block and console devices of NEMU.
+// Requests are put into the rings below and the device is notified
+// once, so a transfer costs a few MMIO accesses however large it is.
+// Only used when built with NEMU_VIRTIO=1, since probing an address
+// without a device is fatal in NEMU.
+
+#define VIRTIO_MAGIC_VALUE         0x000
+#define VIRTIO_VERSION             0x004
+#define VIRTIO_DEVICE_ID           0x008
+#define VIRTIO_DEVICE_FEATURES     0x010
+#define VIRTIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_DRIVER_FEATURES     0x020
+#define VIRTIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_QUEUE_SEL           0x030
+#define VIRTIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_QUEUE_NUM           0x038
+#define VIRTIO_QUEUE_READY         0x044
+#define VIRTIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_INTERRUPT_STATUS    0x060
+#define VIRTIO_INTERRUPT_ACK       0x064
+#define VIRTIO_STATUS              0x070
+#define VIRTIO_QUEUE_DESC_LOW      0x080
+#define VIRTIO_QUEUE_DESC_HIGH     0x084
+#define VIRTIO_QUEUE_AVAIL_LOW     0x090
+#define VIRTIO_QUEUE_AVAIL_HIGH    0x094
+#define VIRTIO_QUEUE_USED_LOW      0x0a0
+#define VIRTIO_QUEUE_USED_HIGH     0x0a4
+#define VIRTIO_CONFIG              0x100
+
+#define VIRTIO_STATUS_ACK         1
+#define VIRTIO_STATUS_DRIVER      2
+#define VIRTIO_STATUS_DRIVER_OK   4
+#define VIRTIO_STATUS_FEATURES_OK 8
+
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2
+
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+
+#define QUEUE_NUM 8
+#define TX_BUF_SIZE 256
+
+#define barrier() asm volatile ("" ::: "memory")
+
+typedef struct {
+  struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags, next;
+  } desc[QUEUE_NUM] __attribute__((aligned(16)));
+  struct {
+    uint16_t flags, idx;
+    uint16_t ring[QUEUE_NUM];
+  } avail;
+  struct {
+    uint16_t flags;
+    volatile uint16_t idx;
+    struct { uint32_t id, len; } ring[QUEUE_NUM];
+  } used __attribute__((aligned(4)));
+} virtq_t;
+
+static bool virtio_setup(uintptr_t base, uint32_t id) {
+  if (inl(base + VIRTIO_MAGIC_VALUE) != 0x74726976 || inl(base + VIRTIO_VERSION) != 2 ||
+      inl(base + VIRTIO_DEVICE_ID) != id) return false;
+  outl(base + VIRTIO_STATUS, 0);
+  outl(base + VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+  outl(base + VIRTIO_DEVICE_FEATURES_SEL, 1);
+  if (!(inl(base + VIRTIO_DEVICE_FEATURES) & 0x1)) return false; // VIRTIO_F_VERSION_1
+  outl(base + VIRTIO_DRIVER_FEATURES_SEL, 0);
+  outl(base + VIRTIO_DRIVER_FEATURES, 0);
+  outl(base + VIRTIO_DRIVER_FEATURES_SEL, 1);
+  outl(base + VIRTIO_DRIVER_FEATURES, 0x1);
+  outl(base + VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK);
+  return (inl(base + VIRTIO_STATUS) & VIRTIO_STATUS_FEATURES_OK) != 0;
+}
+
+static void virtio_driver_ok(uintptr_t base) {
+  outl(base + VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER |
+      VIRTIO_STATUS_FEATURES_OK | VIRTIO_STATUS_DRIVER_OK);
+}
+
+static void virtq_setup(uintptr_t base, int sel, virtq_t *q) {
+  outl(base + VIRTIO_QUEUE_SEL, sel);
+  assert(inl(base + VIRTIO_QUEUE_NUM_MAX) >= QUEUE_NUM);
+  outl(base + VIRTIO_QUEUE_NUM, QUEUE_NUM);
+  uint64_t desc = (uintptr_t)q->desc, avail = (uintptr_t)&q->avail, used = (uintptr_t)&q->used;
+  outl(base + VIRTIO_QUEUE_DESC_LOW,   (uint32_t)desc);
+  outl(base + VIRTIO_QUEUE_DESC_HIGH,  desc >> 32);
+  outl(base + VIRTIO_QUEUE_AVAIL_LOW,  (uint32_t)avail);
+  outl(base + VIRTIO_QUEUE_AVAIL_HIGH, avail >> 32);
+  outl(base + VIRTIO_QUEUE_USED_LOW,   (uint32_t)used);
+  outl(base + VIRTIO_QUEUE_USED_HIGH,  used >> 32);
+  outl(base + VIRTIO_QUEUE_READY, 1);
+}
+
+// submit the chain starting at desc[0] and wait until it is used
+static void virtq_submit(uintptr_t base, int sel, virtq_t *q) {
+  q->avail.ring[q->avail.idx % QUEUE_NUM] = 0;
+  barrier();
+  q->avail.idx ++;
+  barrier();
+  outl(base + VIRTIO_QUEUE_NOTIFY, sel);
+  while (q->used.idx != q->avail.idx) ;
+  outl(base + VIRTIO_INTERRUPT_ACK, inl(base + VIRTIO_INTERRUPT_STATUS));
+}
+
+static void set_desc(virtq_t *q, int i, void *buf, uint32_t len, uint16_t flags) {
+  q->desc[i].addr = (uintptr_t)buf;
+  q->desc[i].len = len;
+  q->desc[i].flags = flags;
+  q->desc[i].next = i + 1;
+}
+
+static virtq_t blk_q, tx_q;
+static bool blk_present = false, console_present = false;
+
+static struct { uint32_t type, reserved; uint64_t sector; } blk_req;
+static volatile uint8_t blk_status;
+
+static char tx_buf[TX_BUF_SIZE];
+static int tx_len = 0;
+
+void __am_virtio_init() {
+  blk_present = virtio_setup(VIRTIO_BLK_ADDR, 2);
+  if (blk_present) {
+    virtq_setup(VIRTIO_BLK_ADDR, 0, &blk_q);
+    virtio_driver_ok(VIRTIO_BLK_ADDR);
+  }
+  console_present = virtio_setup(VIRTIO_CONSOLE_ADDR, 3);
+  if (console_present) {
+    virtq_setup(VIRTIO_CONSOLE_ADDR, 1, &tx_q);
+    virtio_driver_ok(VIRTIO_CONSOLE_ADDR);
+  }
+}
+
+bool __am_virtio_blk_present() { return blk_present; }
+
+void __am_virtio_blk_config(AM_DISK_CONFIG_T *cfg) {
+  cfg->present = blk_present;
+  cfg->blksz = 512;
+  cfg->blkcnt = (blk_present ? inl(VIRTIO_BLK_ADDR + VIRTIO_CONFIG) : 0);
+}
+
+void __am_virtio_blk_blkio(AM_DISK_BLKIO_T *io) {
+  blk_req.type = (io->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN);
+  blk_req.sector = io->blkno;
+  set_desc(&blk_q, 0, &blk_req, sizeof(blk_req), VIRTQ_DESC_F_NEXT);
+  set_desc(&blk_q, 1, io->buf, io->blkcnt * 512, VIRTQ_DESC_F_NEXT | (io->write ? 0 : VIRTQ_DESC_F_WRITE));
+  set_desc(&blk_q, 2, (void *)&blk_status, 1, VIRTQ_DESC_F_WRITE);
+  virtq_submit(VIRTIO_BLK_ADDR, 0, &blk_q);
+  assert(blk_status == 0);
+}
+
+void __am_uart_flush() {
+  if (!console_present || tx_len == 0) return;
+  set_desc(&tx_q, 0, tx_buf, tx_len, 0);
+  virtq_submit(VIRTIO_CONSOLE_ADDR, 1, &tx_q);
+  tx_len = 0;
+}
+
+void __am_uart_config(AM_UART_CONFIG_T *cfg) { cfg->present = console_present; }
+
+// characters are sent a line at a time
+void __am_uart_tx(AM_UART_TX_T *tx) {
+  if (!console_present) return;
+  tx_buf[tx_len ++] = tx->data;
+  if (tx->data == '\n' || tx_len == TX_BUF_SIZE) __am_uart_flush();
+}
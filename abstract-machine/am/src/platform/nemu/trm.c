@@ -14,7 +14,10 @@ void putch(char ch) {
   outb(SERIAL_PORT, ch);
 }
 
+void __am_uart_flush();
+
 void halt(int code) {
+  __am_uart_flush();
   nemu_trap(code);
 
   // should not reach here
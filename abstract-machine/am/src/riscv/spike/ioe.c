@@ -25,3 +25,7 @@ bool ioe_init() {
 
 void ioe_read (int reg, void *buf) { ((handler_t)lut[reg])(buf); }
 void ioe_write(int reg, void *buf) { ((handler_t)lut[reg])(buf); }
+
+void ioe_readv(int n, const int *regs, void **bufs) {
+  for (int i = 0; i < n; i ++) ioe_read(regs[i], bufs[i]);
+}
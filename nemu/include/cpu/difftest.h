@@ -19,26 +19,50 @@
 #include <common.h>
 #include <difftest-def.h>
 
+// the most REFs given with --diff, see DIFFTEST_ASYNC
+#define DIFFTEST_MAX_REF 4
+
 #ifdef CONFIG_DIFFTEST
 void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
+void difftest_sync_mem(paddr_t addr, size_t len);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
 void difftest_step(vaddr_t pc, vaddr_t npc);
+void difftest_intr(word_t NO);
+void difftest_flush();
+void difftest_log_store(paddr_t addr, int len);
 void difftest_detach();
 void difftest_attach();
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
+static inline void difftest_sync_mem(paddr_t addr, size_t len) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
 static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_intr(word_t NO) {}
+static inline void difftest_flush() {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
 #endif
 
+#ifdef CONFIG_DIFFTEST_REPLAY
+uint64_t difftest_replay_begin();
+void difftest_replay_end();
+bool difftest_replaying();
+word_t difftest_input(word_t val);
+word_t difftest_replay_intr();
+#else
+static inline bool difftest_replaying() { return false; }
+static inline word_t difftest_input(word_t val) { return val; }
+#endif
+
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
 extern void (*ref_difftest_raise_intr)(uint64_t NO);
+extern void (*ref_difftest_pagehash)(const paddr_t *addr, int n, uint64_t *hash);
+extern void (*ref_difftest_snapshot)();
+extern void (*ref_difftest_restore)();
 
 static inline bool difftest_check_reg(const char *name, vaddr_t pc, word_t ref, word_t dut) {
   if (ref != dut) {
@@ -20,5 +20,12 @@
 
 typedef void (*alarm_handler_t) ();
 void add_alarm_handle(alarm_handler_t h);
+void alarm_dispatch();
+
+// set by the alarm thread, checked by the CPU thread
+static inline bool alarm_check() {
+  extern int alarm_pending;
+  return __atomic_load_n(&alarm_pending, __ATOMIC_ACQUIRE);
+}
 
 #endif
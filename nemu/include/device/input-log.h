@@ -0,0 +1,34 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_INPUT_LOG_H__
+#define __DEVICE_INPUT_LOG_H__
+
+#include <common.h>
+
+enum { INPUT_KEY, INPUT_TIME, INPUT_END };
+
+void init_input_log();
+void input_record(int type, uint64_t value);
+uint64_t input_replay(int type);
+void input_replay_update();
+
+// instruction count of the next replayed key, checked by device_update()
+static inline bool input_replay_due() {
+  extern uint64_t g_nr_guest_inst, input_next_key;
+  return g_nr_guest_inst >= input_next_key;
+}
+
+#endif
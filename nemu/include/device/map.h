@@ -28,6 +28,9 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  // access statistics
+  uint64_t nr_read, nr_write, bytes;
+  uint64_t host_ns; // host time spent in the callback, with DEVICE_STAT
 } IOMap;
 
 static inline bool map_inside(IOMap *map, paddr_t addr) {
@@ -37,10 +40,7 @@ static inline bool map_inside(IOMap *map, paddr_t addr) {
 static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
   int i;
   for (i = 0; i < size; i ++) {
-    if (map_inside(maps + i, addr)) {
-      difftest_skip_ref();
-      return i;
-    }
+    if (map_inside(maps + i, addr)) return i;
   }
   return -1;
 }
@@ -52,5 +52,6 @@ void add_mmio_map(const char *name, paddr_t addr,
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
+void map_stat_display(IOMap *maps, int nr_map);
 
 #endif
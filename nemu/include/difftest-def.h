@@ -37,4 +37,24 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 # error Unsupport ISA
 #endif
 
+// A REF may export
+//   void difftest_pagehash(const paddr_t *addr, int n, uint64_t *hash)
+// to fill hash[i] with the hash of the page at addr[i], so that the DUT
+// can compare the pages it wrote. Such a REF must also support
+// difftest_memcpy() with DIFFTEST_TO_DUT to copy a page out on a mismatch.
+#define DIFFTEST_PAGE_SIZE 4096
+
+// A REF may also export difftest_snapshot() and difftest_restore() to save
+// its registers and memory and to return to them later.
+
+static inline uint64_t difftest_hash_page(const void *page) {
+  const uint64_t *w = (const uint64_t *)page;
+  uint64_t hash = 0;
+  for (int i = 0; i < DIFFTEST_PAGE_SIZE / (int)sizeof(uint64_t); i ++) {
+    hash = (hash ^ w[i]) * 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
 #endif
@@ -32,6 +32,7 @@ void init_isa();
 extern CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+void isa_reg_log_change(FILE *fp, const CPU_state *prev);
 
 // exec
 struct Decode;
@@ -32,6 +32,12 @@ static inline bool in_pmem(paddr_t addr) {
 }
 
 word_t paddr_read(paddr_t addr, int len);
+word_t paddr_ifetch(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+#ifdef CONFIG_DIFFTEST_REPLAY
+// set while a difftest failure is replayed, to log each access
+extern bool mtrace_on;
+#endif
+
 #endif
@@ -0,0 +1,32 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __MEMORY_SNAPSHOT_H__
+#define __MEMORY_SNAPSHOT_H__
+
+#include <common.h>
+
+// Copy-on-write snapshots of pmem. After snapshot_take(), the first write
+// to each page saves a copy of it, and snapshot_restore() copies the saved
+// pages back. Registers are saved by the caller.
+
+extern bool snapshot_active;
+
+void snapshot_take();
+void snapshot_restore();
+// must be called before [addr, addr + len) is written
+void snapshot_log_store(paddr_t addr, size_t len);
+
+#endif
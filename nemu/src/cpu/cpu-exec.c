@@ -16,6 +16,9 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <device/alarm.h>
+#include <device/input-log.h>
+#include <memory/paddr.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -31,6 +34,17 @@ static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
 void device_update();
+void serial_flush();
+void dev_stat_display();
+void clint_update();
+extern uint64_t clint_deadline;
+
+// Checked after every instruction, so it only reads a flag and compares
+// counters. Without the alarm thread, the clock is sampled now and then.
+static inline bool device_update_due() {
+  return MUXDEF(CONFIG_TARGET_AM, (g_nr_guest_inst & 0xffff) == 0, alarm_check()) ||
+    MUXDEF(CONFIG_INPUT_REPLAY, input_replay_due(), false);
+}
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
@@ -78,17 +92,72 @@ static void execute(uint64_t n) {
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    IFDEF(CONFIG_DEVICE, if (device_update_due()) device_update());
+    IFDEF(CONFIG_HAS_CLINT, if (g_nr_guest_inst >= clint_deadline) clint_update());
+    // QEMU can not be told to take an interrupt through gdb, so they are
+    // left pending when it is the REF
+    word_t intr = MUXDEF(CONFIG_DIFFTEST_REF_QEMU, INTR_EMPTY, isa_query_intr());
+    if (intr != INTR_EMPTY) {
+      cpu.pc = isa_raise_intr(intr, cpu.pc);
+      IFDEF(CONFIG_DIFFTEST, difftest_intr(intr));
+    }
   }
 }
 
+#ifdef CONFIG_DIFFTEST_REPLAY
+// Run the instructions from the last difftest checkpoint up to the failing
+// one again, and log each of them with its data accesses, the registers it
+// changes and the pc when it does not fall through. The devices are left
+// alone: device reads, the memory written by devices and the interrupts
+// are taken from what difftest has logged since the checkpoint.
+static void replay_failure() {
+  uint64_t nr_inst = g_nr_guest_inst;
+  uint64_t n = difftest_replay_begin();
+  if (n == 0) return;
+  extern FILE *log_fp;
+  NEMUState state = nemu_state;
+  nemu_state.state = NEMU_RUNNING;
+  fprintf(log_fp, "Replay of the last %" PRIu64 " instructions before the difftest failure\n", n);
+  mtrace_on = true;
+  Decode s;
+  for (; n > 0 && nemu_state.state == NEMU_RUNNING; n --) {
+    // the checkpoint is taken before the interrupt of the last instruction
+    word_t intr = difftest_replay_intr();
+    if (intr != INTR_EMPTY) {
+      cpu.pc = isa_raise_intr(intr, cpu.pc);
+      fprintf(log_fp, "interrupt " FMT_WORD ", pc = " FMT_WORD "\n", intr, cpu.pc);
+    }
+
+    CPU_state prev = cpu;
+    exec_once(&s, cpu.pc);
+    g_nr_guest_inst ++;
+#ifdef CONFIG_ITRACE
+    fprintf(log_fp, "%s\n", s.logbuf);
+#else
+    fprintf(log_fp, FMT_WORD ": %08x\n", s.pc, s.isa.inst.val);
+#endif
+    isa_reg_log_change(log_fp, &prev);
+    if (cpu.pc != s.snpc) fprintf(log_fp, "  pc = " FMT_WORD "\n", cpu.pc);
+  }
+  mtrace_on = false;
+  fflush(log_fp);
+  difftest_replay_end();
+  // the input log and the statistics go on from where the DUT stopped
+  g_nr_guest_inst = nr_inst;
+  nemu_state = state;
+  Log("The instructions before the difftest failure are replayed in the log");
+}
+#endif
+
 static void statistic() {
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
   Log("host time spent = " NUMBERIC_FMT " us", g_timer);
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_DEVICE, dev_stat_display());
 }
 
 void assert_fail_msg() {
@@ -109,6 +178,9 @@ void cpu_exec(uint64_t n) {
   uint64_t timer_start = get_time();
 
   execute(n);
+  if (nemu_state.state != NEMU_ABORT) difftest_flush();
+  IFDEF(CONFIG_DIFFTEST_REPLAY, if (nemu_state.state == NEMU_ABORT) replay_failure());
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -18,18 +18,312 @@
 #include <isa.h>
 #include <cpu/cpu.h>
 #include <memory/paddr.h>
+#include <memory/host.h>
+#include <memory/snapshot.h>
 #include <utils.h>
-#include <difftest-def.h>
+#include <cpu/difftest.h>
 
 void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = NULL;
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+void (*ref_difftest_pagehash)(const paddr_t *addr, int n, uint64_t *hash) = NULL;
+void (*ref_difftest_snapshot)() = NULL;
+void (*ref_difftest_restore)() = NULL;
 
 #ifdef CONFIG_DIFFTEST
 
+extern uint64_t g_nr_guest_inst;
+
+// Several REFs can be checked at the same time with an asynchronous REF.
+// The first one is also reached by the ref_difftest_* pointers above.
+#define MAX_REF DIFFTEST_MAX_REF
+
+typedef struct {
+  const char *name;
+  void *handle;
+  void (*mem_copy)(paddr_t addr, void *buf, size_t n, bool direction);
+  void (*regcpy)(void *dut, bool direction);
+  void (*exec)(uint64_t n);
+  void (*raise_intr)(uint64_t NO);
+} DiffRef;
+
+static DiffRef refs[MAX_REF];
+static int nr_ref = 0;
+
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
+static bool is_detached = false;
+
+// DUT and REF each run a batch of instructions before the registers are
+// compared. The DUT keeps its state after every instruction of the batch,
+// so that on a mismatch the REF can be rolled back to the start of the
+// batch and the first divergent instruction found by bisection. With a
+// batch of 1 this is lockstep.
+// The REF is rolled back with difftest_snapshot()/difftest_restore() if it
+// exports them. Otherwise the DUT keeps the old contents of the memory it
+// writes and copies them back, together with the registers compared. Then
+// other registers of the REF, e.g. CSRs, and memory written only by the
+// REF are not rolled back, and bisection may miss the first divergence.
+#define BATCH MUXDEF(CONFIG_DIFFTEST_ASYNC, 1, CONFIG_DIFFTEST_BATCH)
+#define UNDO_PER_INST 16  // the most stores of one instruction
+#define UNDO_LOG_LEN (BATCH * 2 + UNDO_PER_INST)
+
+static CPU_state batch_start;           // matched by the REF
+static CPU_state batch_state[BATCH];    // after each instruction
+static vaddr_t batch_pc[BATCH];         // pc of each instruction
+static uint64_t batch_nr_inst;          // g_nr_guest_inst of the first one
+static int batch_len = 0;
+
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} UndoEntry;
+
+static UndoEntry undo_log[UNDO_LOG_LEN];
+static int undo_len = 0;
+
+// Pages written by the DUT are compared with the REF by their hashes
+// every CONFIG_DIFFTEST_MEM_INTERVAL instructions, at a batch boundary.
+// Only the image is copied to the REF at the beginning, so a page is
+// copied as a whole right before it is first written.
+#define MEM_INTERVAL MUXDEF(CONFIG_DIFFTEST_ASYNC, 0, CONFIG_DIFFTEST_MEM_INTERVAL)
+#define NR_PAGE (CONFIG_MSIZE / DIFFTEST_PAGE_SIZE)
+
+static bool mem_check_on = false;
+static bool page_dirty[NR_PAGE];
+static bool page_copied[NR_PAGE];
+static paddr_t dirty_page[NR_PAGE];
+static int nr_dirty = 0;
+static uint64_t mem_nr_inst = 0;
+
+#ifdef CONFIG_DIFFTEST_REPLAY
+// A checkpoint of the DUT is taken at most every CONFIG_DIFFTEST_REPLAY_INTERVAL
+// instructions, right after it has matched the REF. The memory is saved by
+// copy-on-write, so a checkpoint only costs the pages written after it.
+static CPU_state ckpt_cpu;
+static uint64_t ckpt_nr_inst = 0;
+static bool ckpt_valid = false;
+static uint64_t fail_nr_inst = 0;  // the first instruction known to be wrong
+static bool replaying = false;
+
+// Devices are not rolled back, so whatever they feed into the DUT after
+// the checkpoint is logged, and the replay takes it from the log instead
+// of touching the devices again.
+enum {
+  IO_INPUT,  // the value of a device access, or 0 for a write
+  IO_MEM,    // `len` bytes at `data` written by a device to `addr`
+  IO_INTR,   // the interrupt `val` taken after an instruction
+};
+
+typedef struct {
+  int type;
+  uint64_t nr_inst;  // g_nr_guest_inst when it is logged
+  word_t val;
+  paddr_t addr;
+  size_t len;
+  void *data;        // malloc()ed
+} IOEvent;
+
+static IOEvent *io_log = NULL;
+static int io_len = 0, io_max = 0;
+static int io_pos = 0;  // the next event of the replay
+
+static IOEvent* io_log_push(int type) {
+  if (io_len == io_max) {
+    io_max = (io_max == 0 ? 1024 : io_max * 2);
+    io_log = realloc(io_log, sizeof(io_log[0]) * io_max);
+    assert(io_log);
+  }
+  IOEvent *e = &io_log[io_len ++];
+  e->type = type;
+  e->nr_inst = g_nr_guest_inst;
+  e->data = NULL;
+  return e;
+}
+
+static void io_log_reset() {
+  for (int i = 0; i < io_len; i ++) free(io_log[i].data);
+  io_len = 0;
+}
+
+static inline bool io_log_on() { return ckpt_valid && !replaying && !is_detached; }
+
+static void checkpoint() {
+  if (nemu_state.state == NEMU_ABORT) return;
+  if (ckpt_valid && g_nr_guest_inst - ckpt_nr_inst < CONFIG_DIFFTEST_REPLAY_INTERVAL) return;
+  ckpt_cpu = cpu;
+  ckpt_nr_inst = g_nr_guest_inst;
+  ckpt_valid = true;
+  snapshot_take();
+  io_log_reset();
+}
+
+// Roll the DUT back to the last checkpoint after a failure. Return the
+// number of instructions to run again to reach the failing one, or 0.
+uint64_t difftest_replay_begin() {
+  if (!ckpt_valid || fail_nr_inst <= ckpt_nr_inst) return 0;
+  snapshot_restore();
+  cpu = ckpt_cpu;
+  g_nr_guest_inst = ckpt_nr_inst;
+  replaying = true;
+  io_pos = 0;
+  return fail_nr_inst - ckpt_nr_inst;
+}
+
+void difftest_replay_end() {
+  replaying = false;
+}
+
+bool difftest_replaying() {
+  return replaying;
+}
+
+// Apply the memory written by devices up to the next event of another type.
+static void replay_mem() {
+  for (; io_pos < io_len && io_log[io_pos].type == IO_MEM; io_pos ++) {
+    IOEvent *e = &io_log[io_pos];
+    memcpy(guest_to_host(e->addr), e->data, e->len);
+  }
+}
+
+// Log a value the DUT gets from a device, or return the logged one
+// during the replay.
+word_t difftest_input(word_t val) {
+  if (replaying) {
+    replay_mem();
+    Assert(io_pos < io_len && io_log[io_pos].type == IO_INPUT && io_log[io_pos].nr_inst == g_nr_guest_inst,
+        "the replay does not access the devices as logged at pc = " FMT_WORD, cpu.pc);
+    return io_log[io_pos ++].val;
+  }
+  if (io_log_on()) io_log_push(IO_INPUT)->val = val;
+  return val;
+}
+
+// Return the interrupt taken after the last instruction, or INTR_EMPTY.
+// The memory written by devices in between is applied first. This may
+// include the memory written by a device access of the next instruction,
+// which can not notice, since it accesses no other memory.
+word_t difftest_replay_intr() {
+  replay_mem();
+  if (io_pos < io_len && io_log[io_pos].type == IO_INTR && io_log[io_pos].nr_inst == g_nr_guest_inst) {
+    return io_log[io_pos ++].val;
+  }
+  return INTR_EMPTY;
+}
+
+static void io_log_mem(paddr_t addr, size_t len) {
+  if (!io_log_on()) return;
+  IOEvent *e = io_log_push(IO_MEM);
+  e->addr = addr;
+  e->len = len;
+  e->data = malloc(len);
+  assert(e->data);
+  memcpy(e->data, guest_to_host(addr), len);
+}
+#endif
+
+static inline void mark_dirty(paddr_t addr) {
+  int idx = (addr - CONFIG_MBASE) / DIFFTEST_PAGE_SIZE;
+  if (!page_dirty[idx]) {
+    paddr_t page = CONFIG_MBASE + idx * DIFFTEST_PAGE_SIZE;
+    page_dirty[idx] = true;
+    dirty_page[nr_dirty ++] = page;
+    if (!page_copied[idx]) {
+      page_copied[idx] = true;
+      ref_difftest_memcpy(page, guest_to_host(page), DIFFTEST_PAGE_SIZE, DIFFTEST_TO_REF);
+    }
+  }
+}
+
+// called by pmem_write() before the data is written
+void difftest_log_store(paddr_t addr, int len) {
+  IFDEF(CONFIG_DIFFTEST_REPLAY, if (replaying) return);
+  if (is_detached) return;
+  if (BATCH > 1 && ref_difftest_restore == NULL) {
+    Assert(undo_len < UNDO_LOG_LEN, "too many stores in a difftest batch at pc = " FMT_WORD, cpu.pc);
+    undo_log[undo_len ++] = (UndoEntry) { .addr = addr, .len = len, .data = host_read(guest_to_host(addr), len) };
+  }
+  if (mem_check_on) {
+    mark_dirty(addr);
+    mark_dirty(addr + len - 1);
+  }
+}
+
+static void mem_check(vaddr_t pc) {
+  static uint64_t ref_hash[NR_PAGE];
+  ref_difftest_pagehash(dirty_page, nr_dirty, ref_hash);
+  for (int i = 0; i < nr_dirty; i ++) {
+    paddr_t addr = dirty_page[i];
+    page_dirty[(addr - CONFIG_MBASE) / DIFFTEST_PAGE_SIZE] = false;
+    if (nemu_state.state == NEMU_ABORT) continue;
+
+    uint8_t *dut = guest_to_host(addr);
+    if (difftest_hash_page(dut) == ref_hash[i]) continue;
+    // only a page that is different is copied out
+    static uint8_t ref[DIFFTEST_PAGE_SIZE];
+    ref_difftest_memcpy(addr, ref, DIFFTEST_PAGE_SIZE, DIFFTEST_TO_DUT);
+    int off = 0;
+    while (off < DIFFTEST_PAGE_SIZE - 1 && ref[off] == dut[off]) off ++;
+    Log("memory is different at " FMT_PADDR " before executing instruction at pc = " FMT_WORD
+        ", right = 0x%02x, wrong = 0x%02x", addr + off, pc, ref[off], dut[off]);
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+    // the page is only known to be wrong at this point
+    IFDEF(CONFIG_DIFFTEST_REPLAY, fail_nr_inst = g_nr_guest_inst);
+  }
+  nr_dirty = 0;
+  mem_nr_inst = 0;
+}
+
+// Guest memory written directly by a device, e.g. with DMA. It is copied
+// to the REF once the instructions before it have been checked, before
+// the memory is compared, and its pages are compared from then on.
+#define NR_SYNC 16
+
+static struct { paddr_t addr; size_t len; } sync_mem[NR_SYNC];
+static int nr_sync = 0;
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+static void async_init();
+static void async_push_mem(paddr_t addr, size_t len);
+#endif
+
+void difftest_sync_mem(paddr_t addr, size_t len) {
+  if (len == 0 || is_detached) return;
+  IFDEF(CONFIG_DIFFTEST_REPLAY, io_log_mem(addr, len));
+#ifdef CONFIG_DIFFTEST_ASYNC
+  async_push_mem(addr, len);
+  return;
+#endif
+  if (nr_sync == NR_SYNC) {
+    // extend the last range to cover this one as well
+    paddr_t lo = sync_mem[NR_SYNC - 1].addr, hi = lo + sync_mem[NR_SYNC - 1].len;
+    if (addr < lo) lo = addr;
+    if (addr + len > hi) hi = addr + len;
+    sync_mem[NR_SYNC - 1].addr = lo;
+    sync_mem[NR_SYNC - 1].len = hi - lo;
+    return;
+  }
+  sync_mem[nr_sync].addr = addr;
+  sync_mem[nr_sync].len = len;
+  nr_sync ++;
+}
+
+static void copy_sync_mem() {
+  for (int i = 0; i < nr_sync; i ++) {
+    paddr_t addr = sync_mem[i].addr;
+    size_t len = sync_mem[i].len;
+    if (mem_check_on) {
+      for (paddr_t p = addr & ~(paddr_t)(DIFFTEST_PAGE_SIZE - 1); p < addr + len; p += DIFFTEST_PAGE_SIZE) mark_dirty(p);
+    }
+    ref_difftest_memcpy(addr, guest_to_host(addr), len, DIFFTEST_TO_REF);
+  }
+  nr_sync = 0;
+}
+
+static void batch_check();
 
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
@@ -52,6 +346,8 @@ void difftest_skip_ref() {
 //   Let REF run `nr_ref` instructions first.
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
 void difftest_skip_dut(int nr_ref, int nr_dut) {
+  IFDEF(CONFIG_DIFFTEST_ASYNC, panic("skipping DUT instructions is not supported with an asynchronous REF"));
+  if (batch_len > 0) batch_check();
   skip_dut_nr_inst += nr_dut;
 
   while (nr_ref -- > 0) {
@@ -59,36 +355,81 @@ void difftest_skip_dut(int nr_ref, int nr_dut) {
   }
 }
 
-void init_difftest(char *ref_so_file, long img_size, int port) {
-  assert(ref_so_file != NULL);
-
+static void load_ref(const char *ref_so_file, long img_size, int port) {
   void *handle;
   handle = dlopen(ref_so_file, RTLD_LAZY);
   assert(handle);
+  for (int i = 0; i < nr_ref; i ++) {
+    Assert(handle != refs[i].handle, "%s is loaded twice, use a copy of it with another name", ref_so_file);
+  }
 
-  ref_difftest_memcpy = dlsym(handle, "difftest_memcpy");
-  assert(ref_difftest_memcpy);
+  void (*ref_memcpy)(paddr_t, void *, size_t, bool) = dlsym(handle, "difftest_memcpy");
+  assert(ref_memcpy);
 
-  ref_difftest_regcpy = dlsym(handle, "difftest_regcpy");
-  assert(ref_difftest_regcpy);
+  void (*ref_regcpy)(void *, bool) = dlsym(handle, "difftest_regcpy");
+  assert(ref_regcpy);
 
-  ref_difftest_exec = dlsym(handle, "difftest_exec");
-  assert(ref_difftest_exec);
+  void (*ref_exec)(uint64_t) = dlsym(handle, "difftest_exec");
+  assert(ref_exec);
 
-  ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
-  assert(ref_difftest_raise_intr);
+  void (*ref_raise_intr)(uint64_t) = dlsym(handle, "difftest_raise_intr");
+  assert(ref_raise_intr);
 
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
-  Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
+  DiffRef *r = &refs[nr_ref ++];
+  r->name = ref_so_file;
+  r->handle = handle;
+  r->mem_copy = ref_memcpy;
+  r->regcpy = ref_regcpy;
+  r->exec = ref_exec;
+  r->raise_intr = ref_raise_intr;
+
+  if (r == &refs[0]) {
+    ref_difftest_memcpy = ref_memcpy;
+    ref_difftest_regcpy = ref_regcpy;
+    ref_difftest_exec = ref_exec;
+    ref_difftest_raise_intr = ref_raise_intr;
+    // optional, memory is not compared when it is missing
+    ref_difftest_pagehash = dlsym(handle, "difftest_pagehash");
+    // optional, the undo log of the DUT is used when they are missing
+    ref_difftest_snapshot = dlsym(handle, "difftest_snapshot");
+    ref_difftest_restore = dlsym(handle, "difftest_restore");
+    if (ref_difftest_snapshot == NULL || ref_difftest_restore == NULL) {
+      ref_difftest_snapshot = NULL;
+      ref_difftest_restore = NULL;
+    }
+  }
+
   Log("The result of every instruction will be compared with %s. "
       "This will help you a lot for debugging, but also significantly reduce the performance. "
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
 
   ref_difftest_init(port);
-  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
-  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  ref_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+  ref_regcpy(&cpu, DIFFTEST_TO_REF);
+}
+
+void init_difftest(char **ref_so_file, int nr, long img_size, int port) {
+  assert(nr > 0);
+  Assert(nr <= MAX_REF, "at most %d REFs can be checked", MAX_REF);
+  IFNDEF(CONFIG_DIFFTEST_ASYNC, Assert(nr == 1, "several REFs can only be checked with DIFFTEST_ASYNC"));
+
+  Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
+  IFDEF(CONFIG_DIFFTEST_REF_QEMU, Log("QEMU can not take interrupts from the DUT, so interrupts are not delivered"));
+  // each REF communicating with a socket gets its own port
+  for (int i = 0; i < nr; i ++) load_ref(ref_so_file[i], img_size, port + i);
+  batch_start = cpu;
+
+  if (MEM_INTERVAL > 0) {
+    if (ref_difftest_pagehash == NULL) Log("%s can not hash pages, memory is not compared", refs[0].name);
+    else {
+      mem_check_on = true;
+    }
+  }
+
+  IFDEF(CONFIG_DIFFTEST_ASYNC, async_init());
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
@@ -99,14 +440,329 @@ static void checkregs(CPU_state *ref, vaddr_t pc) {
   }
 }
 
+static bool ref_match(DiffRef *r, CPU_state *dut) {
+  CPU_state ref_r;
+  r->regcpy(&ref_r, DIFFTEST_TO_DUT);
+  return memcmp(&ref_r, dut, DIFFTEST_REG_SIZE) == 0;
+}
+
+// bring the REF to the state after the first `k` instructions of the batch
+static void ref_seek(int *at, int k) {
+  if (*at > k) {
+    if (ref_difftest_restore != NULL) ref_difftest_restore();
+    else {
+      for (int i = undo_len - 1; i >= 0; i --) {
+        ref_difftest_memcpy(undo_log[i].addr, &undo_log[i].data, undo_log[i].len, DIFFTEST_TO_REF);
+      }
+      ref_difftest_regcpy(&batch_start, DIFFTEST_TO_REF);
+    }
+    *at = 0;
+  }
+  if (k > *at) ref_difftest_exec(k - *at);
+  *at = k;
+}
+
+static void batch_check() {
+  CPU_state ref_r;
+  int at = 0;
+  if (batch_len > 1 && ref_difftest_snapshot != NULL) ref_difftest_snapshot();
+  ref_seek(&at, batch_len);
+
+  if (!ref_match(&refs[0], &batch_state[batch_len - 1])) {
+    // the states after `lo` instructions match, after `hi` they do not
+    int lo = 0, hi = batch_len;
+    while (hi - lo > 1) {
+      int mid = (lo + hi) / 2;
+      ref_seek(&at, mid);
+      if (ref_match(&refs[0], &batch_state[mid - 1])) lo = mid;
+      else hi = mid;
+    }
+    ref_seek(&at, hi);
+    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+    if (batch_len > 1) {
+      Log("First divergence at instruction %d of a batch of %d", hi, batch_len);
+    }
+    // registers are shown as they were right after that instruction,
+    // while the memory is left as it is at the end of the batch
+    cpu = batch_state[hi - 1];
+    checkregs(&ref_r, batch_pc[hi - 1]);
+    IFDEF(CONFIG_DIFFTEST_REPLAY, fail_nr_inst = batch_nr_inst + hi - 1);
+  }
+
+  vaddr_t npc = batch_state[batch_len - 1].pc;
+  batch_start = batch_state[batch_len - 1];
+  mem_nr_inst += batch_len;
+  batch_len = 0;
+  undo_len = 0;
+
+  copy_sync_mem();
+  if (mem_check_on && mem_nr_inst >= MEM_INTERVAL && nemu_state.state != NEMU_ABORT) mem_check(npc);
+}
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+#include <pthread.h>
+#include <sched.h>
+
+// The DUT only pushes a commit record for each instruction into a ring.
+// Each REF is owned by a host thread, which runs the REF for each record
+// and compares the states. A mismatch is thus reported a few instructions
+// late, but with the exact pc. An idle thread sleeps on `ring_cond`
+// until the DUT pushes again.
+#define RING_LEN 4096
+
+enum {
+  REC_EXEC,  // run an instruction and compare with `state`
+  REC_SKIP,  // copy `state` to the REF instead of running it
+  REC_INTR,  // raise the interrupt `pc` in the REF
+  REC_MEM,   // copy `len` bytes at `data` to the REF at `addr`
+};
+
+typedef struct {
+  int type;
+  vaddr_t pc;       // of the instruction
+  uint64_t nr_inst; // g_nr_guest_inst when the record is pushed
+  CPU_state state;  // after the instruction
+  paddr_t addr;
+  size_t len;
+  void *data;       // malloc()ed, freed when the record is overwritten
+} CommitRec;
+
+static CommitRec ring[RING_LEN];
+static uint64_t ring_tail = 0;          // produced records, written by the DUT
+static uint64_t ring_limit = RING_LEN;  // the DUT can produce up to here without waiting
+static int ref_failed = 0;              // set by the thread of any REF
+static int nr_sleeping = 0;             // REF threads waiting on ring_cond
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+
+// written by the thread of a REF, which stops after a mismatch
+typedef struct {
+  uint64_t head;  // consumed records
+  int failed;
+  CommitRec fail_rec;
+  CPU_state fail_ref;
+} __attribute__((aligned(64))) RefThread;
+
+static RefThread threads[MAX_REF];
+
+#define load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+// The thread announces itself in nr_sleeping before it checks ring_tail
+// for the last time, and the DUT checks nr_sleeping after it has updated
+// ring_tail, so at least one of them sees the other.
+static void ring_wait(uint64_t head) {
+  pthread_mutex_lock(&ring_lock);
+  __atomic_add_fetch(&nr_sleeping, 1, __ATOMIC_SEQ_CST);
+  while (head == __atomic_load_n(&ring_tail, __ATOMIC_SEQ_CST)) pthread_cond_wait(&ring_cond, &ring_lock);
+  __atomic_sub_fetch(&nr_sleeping, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&ring_lock);
+}
+
+static void ring_wake() {
+  if (__atomic_load_n(&nr_sleeping, __ATOMIC_SEQ_CST) == 0) return;
+  pthread_mutex_lock(&ring_lock);
+  pthread_cond_broadcast(&ring_cond);
+  pthread_mutex_unlock(&ring_lock);
+}
+
+static void* ref_thread(void *arg) {
+  DiffRef *ref = arg;
+  RefThread *t = &threads[ref - refs];
+  int idle = 0;
+  while (true) {
+    uint64_t head = t->head;
+    if (head == load_acquire(&ring_tail)) {
+      // spin while the DUT is running, sleep when it stops
+      if (++ idle > 4096) { ring_wait(head); idle = 0; }
+      continue;
+    }
+    idle = 0;
+    CommitRec *r = &ring[head % RING_LEN];
+    if (r->type == REC_SKIP) ref->regcpy(&r->state, DIFFTEST_TO_REF);
+    else if (r->type == REC_INTR) ref->raise_intr(r->pc);
+    else if (r->type == REC_MEM) ref->mem_copy(r->addr, r->data, r->len, DIFFTEST_TO_REF);
+    else {
+      ref->exec(1);
+      if (!ref_match(ref, &r->state)) {
+        ref->regcpy(&t->fail_ref, DIFFTEST_TO_DUT);
+        t->fail_rec = *r;
+        store_release(&t->failed, 1);
+        store_release(&ref_failed, 1);
+        return NULL;
+      }
+    }
+    store_release(&t->head, head + 1);
+  }
+}
+
+static void async_init() {
+  for (int i = 0; i < nr_ref; i ++) {
+    pthread_t t;
+    int ret = pthread_create(&t, NULL, ref_thread, &refs[i]);
+    Assert(ret == 0, "Can not create the difftest thread of %s", refs[i].name);
+    pthread_detach(t);
+  }
+}
+
+// A REF has stopped at a mismatch. The other REFs check the records up
+// to and including the earliest failing one before the result of each
+// REF is shown, and the DUT is left in the state of that divergence.
+static void async_report() {
+  static bool reported = false;
+  if (reported) return;
+  reported = true;
+  uint64_t stop = UINT64_MAX;  // index of the earliest failing record
+  uint64_t stop_inst = 0;      // and the instruction it checks
+  for (int i = 0; i < nr_ref; i ++) {
+    if (load_acquire(&threads[i].failed) && threads[i].head < stop) {
+      stop = threads[i].head;
+      stop_inst = threads[i].fail_rec.nr_inst;
+    }
+  }
+  int first = -1;
+  for (int i = 0; i < nr_ref; i ++) {
+    RefThread *t = &threads[i];
+    while (!load_acquire(&t->failed) && load_acquire(&t->head) <= stop) sched_yield();
+    if (!t->failed) {
+      Log("%s matches the DUT for the first %" PRIu64 " instructions", refs[i].name, stop_inst);
+      continue;
+    }
+    if (t->head < stop) { stop = t->head; stop_inst = t->fail_rec.nr_inst; }
+    Log("%s diverges at instruction %" PRIu64 ", %" PRIu64 " instructions before the DUT",
+        refs[i].name, t->fail_rec.nr_inst, g_nr_guest_inst - t->fail_rec.nr_inst);
+    cpu = t->fail_rec.state;
+    checkregs(&t->fail_ref, t->fail_rec.pc);
+    if (first == -1 || t->head < threads[first].head) first = i;
+  }
+  cpu = threads[first].fail_rec.state;
+  nemu_state.halt_pc = threads[first].fail_rec.pc;
+}
+
+// the slowest REF decides when the DUT has to wait
+static uint64_t ring_min_head() {
+  uint64_t head = load_acquire(&threads[0].head);
+  for (int i = 1; i < nr_ref; i ++) {
+    uint64_t h = load_acquire(&threads[i].head);
+    if (h < head) head = h;
+  }
+  return head;
+}
+
+// wait for a free record, or return NULL after a mismatch
+static CommitRec* async_alloc() {
+  if (load_acquire(&ref_failed)) { async_report(); return NULL; }
+  uint64_t tail = ring_tail;
+  while (tail == ring_limit) {
+    if (load_acquire(&ref_failed)) { async_report(); return NULL; }
+    ring_limit = ring_min_head() + RING_LEN;
+    if (tail == ring_limit) sched_yield();
+  }
+  CommitRec *r = &ring[tail % RING_LEN];
+  if (r->type == REC_MEM) free(r->data);
+  return r;
+}
+
+static void async_commit() {
+  __atomic_store_n(&ring_tail, ring_tail + 1, __ATOMIC_SEQ_CST);
+  ring_wake();
+}
+
+static void async_push(vaddr_t pc, int type) {
+  CommitRec *r = async_alloc();
+  if (r == NULL) return;
+  r->type = type;
+  r->pc = pc;
+  r->nr_inst = g_nr_guest_inst;
+  r->state = cpu;
+  async_commit();
+}
+
+// the data is copied, since the guest may change it before the REF runs
+static void async_push_mem(paddr_t addr, size_t len) {
+  CommitRec *r = async_alloc();
+  if (r == NULL) return;
+  r->type = REC_MEM;
+  r->nr_inst = g_nr_guest_inst;
+  r->addr = addr;
+  r->len = len;
+  r->data = malloc(len);
+  assert(r->data);
+  memcpy(r->data, guest_to_host(addr), len);
+  async_commit();
+}
+
+// wait for the REF threads to check all records
+static void async_drain() {
+  while (ring_min_head() != ring_tail) {
+    if (load_acquire(&ref_failed)) { async_report(); return; }
+    sched_yield();
+  }
+}
+#endif
+
+// compare the instructions of a partial batch, e.g. when cpu_exec() returns
+void difftest_flush() {
+  IFDEF(CONFIG_DIFFTEST_ASYNC, async_drain());
+  if (batch_len > 0) batch_check();
+}
+
+// Stop comparing, e.g. to skip a part of the program in the debugger.
+// Every pending record is checked first, so the REF threads are idle
+// and stay so until difftest_attach() has copied the state of the DUT.
+void difftest_detach() {
+  if (is_detached) return;
+  difftest_flush();
+  is_detached = true;
+  // nothing is logged while detached, so the checkpoint can not be replayed
+  IFDEF(CONFIG_DIFFTEST_REPLAY, ckpt_valid = false);
+}
+
+void difftest_attach() {
+  if (!is_detached) return;
+  is_detached = false;
+  for (int i = 0; i < nr_ref; i ++) {
+    refs[i].mem_copy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, DIFFTEST_TO_REF);
+    refs[i].regcpy(&cpu, DIFFTEST_TO_REF);
+  }
+  memset(page_copied, true, sizeof(page_copied));
+  isa_difftest_attach();
+  batch_start = cpu;
+  is_skip_ref = false;
+}
+
+// The DUT has taken an interrupt after the last instruction. The REF has
+// no devices, so it is told to take the same interrupt at the same point.
+void difftest_intr(word_t NO) {
+  if (is_detached) return;
+  IFDEF(CONFIG_DIFFTEST_REPLAY, if (io_log_on()) io_log_push(IO_INTR)->val = NO);
+#ifdef CONFIG_DIFFTEST_ASYNC
+  async_push(NO, REC_INTR);
+  return;
+#endif
+  if (batch_len > 0) batch_check();
+  if (nemu_state.state == NEMU_ABORT) return;
+  ref_difftest_raise_intr(NO);
+  batch_start = cpu;
+}
+
 void difftest_step(vaddr_t pc, vaddr_t npc) {
   CPU_state ref_r;
 
+  if (is_detached) return;
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+  async_push(pc, is_skip_ref ? REC_SKIP : REC_EXEC);
+  is_skip_ref = false;
+  return;
+#endif
+
   if (skip_dut_nr_inst > 0) {
     ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
     if (ref_r.pc == npc) {
       skip_dut_nr_inst = 0;
       checkregs(&ref_r, npc);
+      batch_start = cpu;
       return;
     }
     skip_dut_nr_inst --;
@@ -116,17 +772,27 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
   }
 
   if (is_skip_ref) {
+    // check the batch before this instruction, then
     // to skip the checking of an instruction, just copy the reg state to reference design
+    if (batch_len > 0) batch_check();
+    copy_sync_mem();
     ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    batch_start = cpu;
+    undo_len = 0;
     is_skip_ref = false;
+    IFDEF(CONFIG_DIFFTEST_REPLAY, checkpoint());
     return;
   }
 
-  ref_difftest_exec(1);
-  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
-
-  checkregs(&ref_r, pc);
+  if (batch_len == 0) batch_nr_inst = g_nr_guest_inst;
+  batch_pc[batch_len] = pc;
+  batch_state[batch_len ++] = cpu;
+  // end the batch early before the next instruction may overflow the undo log
+  if (batch_len == BATCH || undo_len > UNDO_LOG_LEN - UNDO_PER_INST) {
+    batch_check();
+    IFDEF(CONFIG_DIFFTEST_REPLAY, checkpoint());
+  }
 }
 #else
-void init_difftest(char *ref_so_file, long img_size, int port) { }
+void init_difftest(char **ref_so_file, int nr, long img_size, int port) { }
 #endif
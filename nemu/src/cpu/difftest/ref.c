@@ -17,21 +17,52 @@
 #include <cpu/cpu.h>
 #include <difftest-def.h>
 #include <memory/paddr.h>
+#include <memory/snapshot.h>
+
+// NEMU as the REF. Memory and registers are accessed in place, and
+// difftest_exec() runs the interpreter loop directly, so a large batch
+// runs at full speed.
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) {
+    if (snapshot_active) snapshot_log_store(addr, n);
+    memcpy(guest_to_host(addr), buf, n);
+  } else {
+    memcpy(buf, guest_to_host(addr), n);
+  }
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+  else memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
+}
+
+__EXPORT void difftest_pagehash(const paddr_t *addr, int n, uint64_t *hash) {
+  for (int i = 0; i < n; i ++) hash[i] = difftest_hash_page(guest_to_host(addr[i]));
 }
 
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  cpu_exec(n);
 }
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
+}
+
+static CPU_state snap_cpu;
+static NEMUState snap_state;
+
+// only one snapshot is kept, taking another one replaces it
+__EXPORT void difftest_snapshot() {
+  snap_cpu = cpu;
+  snap_state = nemu_state;
+  snapshot_take();
+}
+
+__EXPORT void difftest_restore() {
+  snapshot_restore();
+  cpu = snap_cpu;
+  nemu_state = snap_state;
 }
 
 __EXPORT void difftest_init(int port) {
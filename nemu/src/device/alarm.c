@@ -15,37 +15,64 @@
 
 #include <common.h>
 #include <device/alarm.h>
-#include <sys/time.h>
-#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
-#define MAX_HANDLER 8
+// A host thread waits on a timerfd and only raises `alarm_pending`.
+// The handlers are run later by the CPU thread in alarm_dispatch(),
+// so they do not interrupt the hot loop and need not be signal safe.
 
-static alarm_handler_t handler[MAX_HANDLER] = {};
-static int idx = 0;
+int alarm_pending = 0;
+
+static alarm_handler_t *handler = NULL;
+static int nr_handler = 0;
 
 void add_alarm_handle(alarm_handler_t h) {
-  assert(idx < MAX_HANDLER);
-  handler[idx ++] = h;
+  handler = realloc(handler, sizeof(handler[0]) * (nr_handler + 1));
+  assert(handler);
+  handler[nr_handler ++] = h;
 }
 
-static void alarm_sig_handler(int signum) {
-  int i;
-  for (i = 0; i < idx; i ++) {
+void alarm_dispatch() {
+  __atomic_store_n(&alarm_pending, 0, __ATOMIC_RELAXED);
+  for (int i = 0; i < nr_handler; i ++) {
     handler[i]();
   }
 }
 
+static void* alarm_thread(void *arg) {
+  int epfd = (intptr_t)arg;
+  struct epoll_event ev;
+  while (true) {
+    int n = epoll_wait(epfd, &ev, 1, -1);
+    if (n <= 0) continue; // interrupted
+    uint64_t expired;
+    if (read(ev.data.fd, &expired, sizeof(expired)) == sizeof(expired)) {
+      __atomic_store_n(&alarm_pending, 1, __ATOMIC_RELEASE);
+    }
+  }
+  return NULL;
+}
+
 void init_alarm() {
-  struct sigaction s;
-  memset(&s, 0, sizeof(s));
-  s.sa_handler = alarm_sig_handler;
-  int ret = sigaction(SIGVTALRM, &s, NULL);
-  Assert(ret == 0, "Can not set signal handler");
-
-  struct itimerval it = {};
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 1000000 / TIMER_HZ;
+  int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  Assert(tfd >= 0, "Can not create timerfd");
+  struct itimerspec it = {};
+  it.it_value.tv_nsec = 1000000000 / TIMER_HZ;
   it.it_interval = it.it_value;
-  ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
+  int ret = timerfd_settime(tfd, 0, &it, NULL);
   Assert(ret == 0, "Can not set timer");
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  Assert(epfd >= 0, "Can not create epoll instance");
+  struct epoll_event ev = { .events = EPOLLIN, .data.fd = tfd };
+  ret = epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+  Assert(ret == 0, "Can not add timerfd to epoll");
+
+  pthread_t t;
+  ret = pthread_create(&t, NULL, alarm_thread, (void *)(intptr_t)epfd);
+  Assert(ret == 0, "Can not create alarm thread");
+  pthread_detach(t);
 }
@@ -30,7 +30,101 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+// `sbuf` is a single-producer/single-consumer ring. The guest is the
+// producer: it fills the ring from its own write pointer and commits
+// the bytes by writing their number to `reg_count`. The sink is the
+// consumer. Both counters are free-running and only written by their
+// owner, so no lock is needed between the CPU thread and the SDL
+// audio thread. Reading `reg_count` returns the bytes in use.
+static uint32_t sb_head = 0; // consumed bytes, written by the sink
+static uint32_t sb_tail = 0; // produced bytes, written by the guest
+
+#define load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static uint32_t sb_consume(uint8_t *dst, uint32_t len) {
+  uint32_t head = sb_head;
+  uint32_t avail = load_acquire(&sb_tail) - head;
+  uint32_t n = (len < avail ? len : avail);
+  uint32_t h = head % CONFIG_SB_SIZE;
+  uint32_t n1 = (h + n > CONFIG_SB_SIZE ? CONFIG_SB_SIZE - h : n);
+  if (dst != NULL) {
+    memcpy(dst, sbuf + h, n1);
+    memcpy(dst + n1, sbuf, n - n1);
+  }
+  store_release(&sb_head, head + n);
+  return n;
+}
+
+#ifdef CONFIG_AUDIO_SINK_SDL
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  uint32_t n = sb_consume(stream, len);
+  if (n < len) memset(stream + n, 0, len - n);
+}
+
+static void audio_sink_init() {
+  SDL_AudioSpec s = {};
+  s.freq = audio_base[reg_freq];
+  s.format = AUDIO_S16SYS;
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_play;
+  s.userdata = NULL;
+
+  SDL_CloseAudio();
+  sb_head = sb_tail = 0;
+  int ret = SDL_InitSubSystem(SDL_INIT_AUDIO);
+  if (ret == 0) {
+    SDL_OpenAudio(&s, NULL);
+    SDL_PauseAudio(0);
+  }
+}
+
+static void audio_sink_commit() {}
+#else
+// Without a sound card, data is drained as soon as it is committed,
+// so the guest is never throttled to the playback rate.
+static FILE *sink_fp = NULL;
+
+static void audio_sink_init() {
+  sb_head = sb_tail = 0;
+#ifdef CONFIG_AUDIO_SINK_FILE
+  if (sink_fp == NULL) {
+    sink_fp = fopen(CONFIG_AUDIO_SINK_PATH, "wb");
+    Assert(sink_fp, "Can not open '%s'", CONFIG_AUDIO_SINK_PATH);
+  }
+#endif
+}
+
+static void audio_sink_commit() {
+  static uint8_t buf[CONFIG_SB_SIZE];
+  uint32_t n = sb_consume(sink_fp ? buf : NULL, CONFIG_SB_SIZE);
+  if (sink_fp != NULL) fwrite(buf, 1, n, sink_fp);
+}
+#endif
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init]) {
+        audio_sink_init();
+        audio_base[reg_init] = 0;
+      }
+      break;
+    case reg_count:
+      if (is_write) {
+        uint32_t tail = sb_tail + audio_base[reg_count];
+        Assert(tail - load_acquire(&sb_head) <= CONFIG_SB_SIZE, "audio stream buffer overflow");
+        store_release(&sb_tail, tail);
+        audio_sink_commit();
+      }
+      audio_base[reg_count] = sb_tail - load_acquire(&sb_head);
+      break;
+    case reg_sbuf_size:
+      audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
+      break;
+    default: break;
+  }
 }
 
 void init_audio() {
@@ -41,6 +135,7 @@ void init_audio() {
 #else
   add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler);
 #endif
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
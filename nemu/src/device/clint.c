@@ -0,0 +1,81 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <device/map.h>
+
+// CLINT with the standard register layout. mtime counts guest
+// instructions instead of host time, so a timer interrupt is taken at
+// the same instruction in every run. Instead of polling the device,
+// the CPU loop compares the instruction counter with `clint_deadline`.
+
+#define CLINT_MSIP     0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+#define CLINT_SIZE     0x10000
+
+#define INST_PER_TICK CONFIG_CLINT_INST_PER_TICK
+
+extern uint64_t g_nr_guest_inst;
+uint64_t clint_deadline = UINT64_MAX;
+
+static uint8_t *clint_base = NULL;
+static uint64_t mtimecmp = UINT64_MAX;
+static uint64_t mtime_offset = 0;
+
+static uint64_t get_mtime() {
+  return g_nr_guest_inst / INST_PER_TICK + mtime_offset;
+}
+
+// Also called by the CPU loop once `clint_deadline` is reached.
+void clint_update() {
+  uint64_t now = get_mtime();
+  if (now >= mtimecmp) {
+    cpu.csr.mip |= MIP_MTIP;
+    clint_deadline = UINT64_MAX;
+    return;
+  }
+  cpu.csr.mip &= ~MIP_MTIP;
+  uint64_t tick = g_nr_guest_inst / INST_PER_TICK + (mtimecmp - now);
+  clint_deadline = (tick > UINT64_MAX / INST_PER_TICK ? UINT64_MAX : tick * INST_PER_TICK);
+}
+
+static void clint_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+    if (is_write) {
+      uint64_t mtime = *(uint64_t *)(clint_base + CLINT_MTIME);
+      mtime_offset = mtime - g_nr_guest_inst / INST_PER_TICK;
+      clint_update();
+    } else {
+      *(uint64_t *)(clint_base + CLINT_MTIME) = get_mtime();
+    }
+  } else if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+    if (is_write) {
+      mtimecmp = *(uint64_t *)(clint_base + CLINT_MTIMECMP);
+      clint_update();
+    }
+  } else if (offset < CLINT_MSIP + 4) {
+    if (is_write) {
+      if (clint_base[CLINT_MSIP] & 0x1) cpu.csr.mip |= MIP_MSIP;
+      else cpu.csr.mip &= ~MIP_MSIP;
+    }
+  }
+}
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  *(uint64_t *)(clint_base + CLINT_MTIMECMP) = mtimecmp;
+  add_mmio_map("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, clint_io_handler);
+}
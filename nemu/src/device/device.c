@@ -16,6 +16,7 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/input-log.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -23,27 +24,32 @@
 void init_map();
 void init_serial();
 void init_timer();
+void init_clint();
 void init_vga();
 void init_i8042();
+void init_iosnap();
 void init_audio();
 void init_disk();
 void init_sdcard();
+void init_virtio_blk();
+void init_virtio_console();
 void init_alarm();
+void mmio_stat_display();
+void pio_stat_display();
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
+void serial_update();
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
-
-  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+// Device work is done at deadlines instead of after every instruction.
+// Display and serial input are refreshed at the frame rate by an alarm
+// handler. Host input events are polled at the same rate, and also on
+// demand when the guest reads the keyboard. Audio needs nothing from
+// here: it is pulled by the SDL audio thread or drained on commit.
+// The CPU loop only calls device_update() when device_update_due().
 
-#ifndef CONFIG_TARGET_AM
+static void poll_events() {
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_VGA_HEADLESS)
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
@@ -66,8 +72,47 @@ void device_update() {
 #endif
 }
 
+// called when the guest reads the keyboard, at most once per millisecond
+void device_poll_input() {
+  static uint64_t last = 0;
+  uint64_t now = get_time();
+  if (now - last < 1000) return;
+  last = now;
+  poll_events();
+}
+
+static void device_frame_update() {
+  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, serial_update());
+  poll_events();
+}
+
+void device_update() {
+#ifdef CONFIG_TARGET_AM
+  static uint64_t last = 0;
+  uint64_t now = get_time();
+  if (now - last >= 1000000 / TIMER_HZ) {
+    last = now;
+    device_frame_update();
+  }
+#else
+  if (alarm_check()) alarm_dispatch();
+#endif
+  IFDEF(CONFIG_INPUT_REPLAY, if (input_replay_due()) input_replay_update());
+}
+
+void dev_stat_display() {
+#ifdef CONFIG_DEVICE_STAT
+  _Log("%-16s %14s %14s %16s %14s %10s\n", "device", "reads", "writes", "bytes", "host us", "ns/access");
+#else
+  _Log("%-16s %14s %14s %16s\n", "device", "reads", "writes", "bytes");
+#endif
+  mmio_stat_display();
+  pio_stat_display();
+}
+
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_VGA_HEADLESS)
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
@@ -79,11 +124,18 @@ void init_device() {
 
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
   IFDEF(CONFIG_HAS_VGA, init_vga());
   IFDEF(CONFIG_HAS_KEYBOARD, init_i8042());
+  IFDEF(CONFIG_HAS_IOSNAP, init_iosnap());
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
+  IFDEF(CONFIG_HAS_VIRTIO, init_virtio_blk());
+  IFDEF(CONFIG_HAS_VIRTIO, init_virtio_console());
 
   IFNDEF(CONFIG_TARGET_AM, init_alarm());
+  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(device_frame_update));
+  IFDEF(CONFIG_INPUT_RECORD, init_input_log());
+  IFDEF(CONFIG_INPUT_REPLAY, init_input_log());
 }
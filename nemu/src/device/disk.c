@@ -14,6 +14,88 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The disk image is mmap()ed into NEMU. A transfer of any number of
+// blocks is a single memcpy() between the mapping and the guest memory,
+// so the guest only needs a few MMIO accesses per request.
+
+#define BLKSZ 512
+
+enum {
+  reg_present,
+  reg_blksz,
+  reg_blkcnt,
+  reg_blkno,   // first block of the transfer
+  reg_count,   // number of blocks
+  reg_buf,     // guest physical address of the buffer
+  reg_cmd,     // write to start the transfer
+  nr_reg
+};
+
+enum { DISK_CMD_READ, DISK_CMD_WRITE };
+
+static uint32_t *disk_base = NULL;
+static uint8_t *disk_img = NULL;
+static size_t disk_img_size = 0;
+
+static void disk_transfer(bool is_write) {
+  uint64_t off = (uint64_t)disk_base[reg_blkno] * BLKSZ;
+  uint64_t len = (uint64_t)disk_base[reg_count] * BLKSZ;
+  paddr_t buf = disk_base[reg_buf];
+  Assert(disk_img != NULL, "disk is not present");
+  Assert(off + len <= disk_img_size, "disk access [%" PRIu64 ", %" PRIu64 ") is out of bound %zu",
+      off, off + len, disk_img_size);
+  if (len == 0) return;
+  Assert(len <= CONFIG_MSIZE && in_pmem(buf) && in_pmem(buf + len - 1), "disk buffer " FMT_PADDR " is out of pmem", buf);
+  if (is_write) memcpy(disk_img + off, guest_to_host(buf), len);
+  else {
+    memcpy(guest_to_host(buf), disk_img + off, len);
+    difftest_sync_mem(buf, len);
+  }
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == reg_cmd * sizeof(uint32_t)) {
+    disk_transfer(disk_base[reg_cmd] == DISK_CMD_WRITE);
+  }
+}
+
+static void init_disk_img(const char *img) {
+  int fd = open(img, O_RDWR);
+  if (fd < 0) {
+    Log("Can not find disk image: %s", img);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  disk_img_size = st.st_size / BLKSZ * BLKSZ;
+  if (disk_img_size > 0) {
+    disk_img = mmap(NULL, disk_img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(disk_img != MAP_FAILED, "Can not mmap disk image: %s", img);
+  }
+  close(fd);
+  Log("Disk image: %s, %zu blocks", img, disk_img_size / BLKSZ);
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
+
+  const char *img = CONFIG_DISK_IMG_PATH;
+  if (img[0] != '\0') init_disk_img(img);
+
+  disk_base[reg_present] = (disk_img != NULL);
+  disk_base[reg_blksz] = BLKSZ;
+  disk_base[reg_blkcnt] = disk_img_size / BLKSZ;
 }
@@ -0,0 +1,146 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <utils.h>
+#include <device/input-log.h>
+
+// Inputs which the guest can observe are logged with the guest
+// instruction count at which they happen:
+//   INPUT_KEY  - a key event put into the keyboard queue by send_key()
+//   INPUT_TIME - the value returned by an RTC read
+//   INPUT_END  - the end of the recorded run
+// An entry is (varint inst delta, type byte, varint value), with the
+// value of INPUT_TIME stored as the delta to the previous one.
+// Replaying the log reproduces the run without SDL or the host clock.
+
+#define INPUT_LOG_MAGIC "NEMUINP1"
+
+uint64_t input_next_key = UINT64_MAX;
+
+static FILE *input_fp = NULL;
+static uint64_t last_inst = 0, last_time = 0;
+
+void key_inject(uint32_t am_scancode);
+
+#ifdef CONFIG_INPUT_RECORD
+static void put_varint(uint64_t v) {
+  while (v >= 0x80) {
+    fputc((v & 0x7f) | 0x80, input_fp);
+    v >>= 7;
+  }
+  fputc(v, input_fp);
+}
+
+void input_record(int type, uint64_t value) {
+  extern uint64_t g_nr_guest_inst;
+  put_varint(g_nr_guest_inst - last_inst);
+  last_inst = g_nr_guest_inst;
+  fputc(type, input_fp);
+  if (type == INPUT_TIME) {
+    put_varint(value - last_time);
+    last_time = value;
+  } else {
+    put_varint(value);
+  }
+}
+#endif
+
+#ifdef CONFIG_INPUT_REPLAY
+static bool get_varint(uint64_t *v) {
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(input_fp);
+    if (c == EOF) return false;
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+static struct {
+  bool valid;
+  int type;
+  uint64_t inst, value;
+} next = {};
+
+static void fetch_next() {
+  uint64_t delta, value;
+  int type = EOF;
+  next.valid = get_varint(&delta) && (type = fgetc(input_fp)) != EOF && get_varint(&value);
+  input_next_key = UINT64_MAX;
+  if (!next.valid) return;
+  next.inst = last_inst + delta;
+  next.type = type;
+  last_inst = next.inst;
+  if (type == INPUT_TIME) {
+    last_time += value;
+    next.value = last_time;
+  } else {
+    next.value = value;
+    input_next_key = next.inst; // INPUT_KEY or INPUT_END
+  }
+}
+
+uint64_t input_replay(int type) {
+  extern uint64_t g_nr_guest_inst;
+  Assert(next.valid, "input log is truncated at guest instruction %" PRIu64, g_nr_guest_inst);
+  if (next.type != type || next.inst != g_nr_guest_inst) {
+    panic("input replay diverged at guest instruction %" PRIu64 ": expect type %d at %" PRIu64,
+        g_nr_guest_inst, next.type, next.inst);
+  }
+  uint64_t value = next.value;
+  fetch_next();
+  return value;
+}
+
+void input_replay_update() {
+  extern uint64_t g_nr_guest_inst;
+  while (next.valid && next.type == INPUT_KEY && next.inst <= g_nr_guest_inst) {
+    key_inject(next.value);
+    fetch_next();
+  }
+  if (next.valid && next.type == INPUT_END && next.inst <= g_nr_guest_inst) {
+    // the recorded run was quit here, so is the replay
+    Log("End of input log at guest instruction %" PRIu64, g_nr_guest_inst);
+    nemu_state.state = NEMU_QUIT;
+    input_next_key = UINT64_MAX;
+  }
+}
+#endif
+
+static void close_input_log() {
+  IFDEF(CONFIG_INPUT_RECORD, input_record(INPUT_END, 0));
+  fclose(input_fp);
+}
+
+void init_input_log() {
+  const char *path = CONFIG_INPUT_LOG_PATH;
+  char magic[sizeof(INPUT_LOG_MAGIC) - 1];
+#ifdef CONFIG_INPUT_RECORD
+  input_fp = fopen(path, "wb");
+  Assert(input_fp, "Can not open '%s' to record inputs", path);
+  setvbuf(input_fp, NULL, _IOFBF, 1 << 16);
+  fwrite(INPUT_LOG_MAGIC, sizeof(magic), 1, input_fp);
+  Log("Recording inputs to %s", path);
+#else
+  input_fp = fopen(path, "rb");
+  Assert(input_fp, "Can not open '%s' to replay inputs", path);
+  Assert(fread(magic, sizeof(magic), 1, input_fp) == 1 && memcmp(magic, INPUT_LOG_MAGIC, sizeof(magic)) == 0,
+      "'%s' is not an input log", path);
+  fetch_next();
+  Log("Replaying inputs from %s", path);
+#endif
+  atexit(close_input_log);
+}
@@ -15,5 +15,8 @@
 
 #include <isa.h>
 
+// All devices share the machine external interrupt line. It is cleared
+// when the interrupt is taken, and the guest asks the devices for the cause.
 void dev_raise_intr() {
+  IFDEF(CONFIG_ISA_riscv, cpu.csr.mip |= MIP_MEIP);
 }
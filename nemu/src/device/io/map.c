@@ -17,6 +17,9 @@
 #include <memory/host.h>
 #include <memory/vaddr.h>
 #include <device/map.h>
+#ifdef CONFIG_DEVICE_STAT
+#include <time.h>
+#endif
 
 #define IO_SPACE_MAX (2 * 1024 * 1024)
 
@@ -42,29 +45,73 @@ static void check_bound(IOMap *map, paddr_t addr) {
   }
 }
 
-static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_write) {
-  if (c != NULL) { c(offset, len, is_write); }
+#ifdef CONFIG_DEVICE_STAT
+static inline uint64_t host_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
 }
 
+static void invoke_callback(IOMap *map, paddr_t offset, int len, bool is_write) {
+  if (map->callback != NULL) {
+    uint64_t start = host_ns();
+    map->callback(offset, len, is_write);
+    map->host_ns += host_ns() - start;
+  }
+}
+#else
+static void invoke_callback(IOMap *map, paddr_t offset, int len, bool is_write) {
+  if (map->callback != NULL) map->callback(offset, len, is_write);
+}
+#endif
+
 void init_map() {
   io_space = malloc(IO_SPACE_MAX);
   assert(io_space);
   p_space = io_space;
 }
 
+// An instruction accessing a device can not be run by the REF,
+// so its registers are copied to the REF instead.
+// The replay of a difftest failure takes the values read from the log
+// and does not write to the devices again.
 word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  difftest_skip_ref();
+  if (difftest_replaying()) return difftest_input(0);
   paddr_t offset = addr - map->low;
-  invoke_callback(map->callback, offset, len, false); // prepare data to read
+  map->nr_read ++;
+  map->bytes += len;
+  invoke_callback(map, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
-  return ret;
+  return difftest_input(ret);
 }
 
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  difftest_skip_ref();
+  if (difftest_replaying()) { difftest_input(0); return; }
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
-  invoke_callback(map->callback, offset, len, true);
+  map->nr_write ++;
+  map->bytes += len;
+  invoke_callback(map, offset, len, true);
+  difftest_input(0);
+}
+
+void map_stat_display(IOMap *maps, int nr_map) {
+  for (int i = 0; i < nr_map; i ++) {
+    IOMap *m = &maps[i];
+    uint64_t nr_access = m->nr_read + m->nr_write;
+    if (nr_access == 0) continue;
+#ifdef CONFIG_DEVICE_STAT
+    _Log("%-16s %14" PRIu64 " %14" PRIu64 " %16" PRIu64 " %14" PRIu64 " %10" PRIu64 "\n",
+        m->name, m->nr_read, m->nr_write, m->bytes, m->host_ns / 1000, m->host_ns / nr_access);
+#else
+    _Log("%-16s %14" PRIu64 " %14" PRIu64 " %16" PRIu64 "\n",
+        m->name, m->nr_read, m->nr_write, m->bytes);
+#endif
+  }
 }
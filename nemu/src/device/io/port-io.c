@@ -33,6 +33,10 @@ void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_
   nr_map ++;
 }
 
+void pio_stat_display() {
+  map_stat_display(maps, nr_map);
+}
+
 /* CPU interface */
 uint32_t pio_read(ioaddr_t addr, int len) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
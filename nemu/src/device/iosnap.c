@@ -0,0 +1,64 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <memory/paddr.h>
+
+// Serve several IOE registers with a single access. The guest sets the
+// address of a snapshot block once, then each write of a request mask
+// to reg_cmd fills the requested fields of the block.
+
+enum {
+  reg_addr,  // guest physical address of the snapshot block
+  reg_cmd,   // write a request mask to take a snapshot
+  nr_reg
+};
+
+#define SNAP_UPTIME 0x1
+#define SNAP_KEY    0x2
+#define SNAP_GPU    0x4
+
+typedef struct {
+  uint64_t uptime;
+  uint32_t key;
+  uint32_t gpu_ready;
+} Snapshot;
+
+uint64_t rtc_get_us();
+uint32_t i8042_dequeue();
+
+static uint32_t *iosnap_base = NULL;
+
+static void iosnap_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write || offset != reg_cmd * sizeof(uint32_t)) return;
+  paddr_t addr = iosnap_base[reg_addr];
+  Assert(in_pmem(addr) && in_pmem(addr + sizeof(Snapshot) - 1), "snapshot block " FMT_PADDR " is out of pmem", addr);
+  Snapshot *s = (Snapshot *)guest_to_host(addr);
+  uint32_t mask = iosnap_base[reg_cmd];
+  if (mask & SNAP_UPTIME) s->uptime = rtc_get_us();
+  if (mask & SNAP_KEY) s->key = i8042_dequeue();
+  if (mask & SNAP_GPU) s->gpu_ready = 1;
+  difftest_sync_mem(addr, sizeof(Snapshot));
+}
+
+void init_iosnap() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  iosnap_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("iosnap", CONFIG_IOSNAP_PORT, iosnap_base, space_size, iosnap_io_handler);
+#else
+  add_mmio_map("iosnap", CONFIG_IOSNAP_MMIO, iosnap_base, space_size, iosnap_io_handler);
+#endif
+}
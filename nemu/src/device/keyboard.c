@@ -15,9 +15,12 @@
 
 #include <device/map.h>
 #include <utils.h>
+#include <device/input-log.h>
 
 #define KEYDOWN_MASK 0x8000
 
+void device_poll_input();
+
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 
@@ -65,11 +68,17 @@ static uint32_t key_dequeue() {
 }
 
 void send_key(uint8_t scancode, bool is_keydown) {
+  IFDEF(CONFIG_INPUT_REPLAY, return); // keys come from the input log
   if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != NEMU_KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
     key_enqueue(am_scancode);
+    IFDEF(CONFIG_INPUT_RECORD, input_record(INPUT_KEY, am_scancode));
   }
 }
+
+void key_inject(uint32_t am_scancode) {
+  key_enqueue(am_scancode);
+}
 #else // !CONFIG_TARGET_AM
 #define NEMU_KEY_NONE 0
 
@@ -80,12 +89,17 @@ static uint32_t key_dequeue() {
 }
 #endif
 
+uint32_t i8042_dequeue() {
+  IFNDEF(CONFIG_TARGET_AM, device_poll_input());
+  return key_dequeue();
+}
+
 static uint32_t *i8042_data_port_base = NULL;
 
 static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
   assert(!is_write);
   assert(offset == 0);
-  i8042_data_port_base[0] = key_dequeue();
+  i8042_data_port_base[0] = i8042_dequeue();
 }
 
 void init_i8042() {
@@ -14,6 +14,11 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -28,8 +33,14 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
-// right after sending the actual read/write commands.
+// The DMA engine of bcm2835 is not modeled, so the driver must be modified
+// either to start PIO right after sending the actual read/write commands,
+// or to use the DMA registers below, which are specific to NEMU:
+// write the guest physical address to SDDMAADDR and the number of blocks
+// to SDDMACNT, then write 1 to SDDMACTL. The whole transfer is done at
+// once, then SDHSTS_BLOCK_IRPT is set. If SDHCFG_BLOCK_IRPT_EN is set,
+// the shared external interrupt line is also raised (see intr.c), and
+// the handler reads SDHSTS to find the cause. Otherwise poll SDHSTS.
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
@@ -37,24 +48,93 @@ enum {
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
-  SDHBLC
+  SDHBLC, __PAD20, __PAD21, __PAD22,
+  SDDMAADDR, SDDMACNT, SDDMACTL
 };
 
-static FILE *fp = NULL;
+#define SDHSTS_BLOCK_IRPT    0x200
+#define SDHCFG_BLOCK_IRPT_EN (1 << 8)
+#define SD_BLOCK_SIZE 512
+
+// The card image is mmap()ed, so SDDATA is served from memory instead
+// of calling stdio on every word. Written ranges are handed to the
+// kernel for write-back once per transfer, and synced at exit.
+static uint8_t *img = NULL;
+static uint64_t img_size = 0;
+static uint64_t pos = 0;
+static uint64_t dirty_lo = UINT64_MAX, dirty_hi = 0;
+
 static uint32_t *base = NULL;
+static uint32_t hsts = 0; // SDHSTS is write-1-to-clear, keep it here
 static uint32_t blkcnt = 0;
-static long blk_addr = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
 
 static void prepare_rw(int is_write) {
-  blk_addr = base[SDARG];
+  pos = (uint64_t)base[SDARG] << 9;
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
 }
 
+static void sdcard_writeback(int flags) {
+  if (dirty_lo < dirty_hi) {
+    uint64_t lo = dirty_lo & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    msync(img + lo, dirty_hi - lo, flags);
+    dirty_lo = UINT64_MAX;
+    dirty_hi = 0;
+  }
+}
+
+static void sdcard_sync() {
+  sdcard_writeback(MS_SYNC);
+}
+
+static void sdcard_data_rw(void *buf, uint64_t len) {
+  // the part out of the image reads as zero, and writes to it are ignored
+  uint64_t n = (pos >= img_size ? 0 : pos + len > img_size ? img_size - pos : len);
+  if (!write_cmd) {
+    memcpy(buf, img + pos, n);
+    memset((uint8_t *)buf + n, 0, len - n);
+  } else if (n > 0) {
+    memcpy(img + pos, buf, n);
+    if (pos < dirty_lo) dirty_lo = pos;
+    if (pos + n > dirty_hi) dirty_hi = pos + n;
+  }
+  pos += len;
+}
+
+static uint32_t ext_csd_read(uint32_t addr) {
+  // See section 8.1 JEDEC Standard JED84-A441
+  switch (addr) {
+    case 192: return 2; // EXT_CSD_REV
+    case 212: return MEMORY_SIZE / 512;
+    default: return 0;
+  }
+}
+
+static void sdcard_dma() {
+  paddr_t buf = base[SDDMAADDR];
+  uint64_t len = (uint64_t)base[SDDMACNT] * SD_BLOCK_SIZE;
+  Assert(len <= CONFIG_MSIZE && in_pmem(buf) && in_pmem(buf + len - 1),
+      "sdcard DMA buffer [" FMT_PADDR ", +%" PRIu64 ") is out of pmem", buf, len);
+  if (read_ext_csd) {
+    uint32_t *p = (uint32_t *)guest_to_host(buf);
+    for (addr = 0; addr < SD_BLOCK_SIZE; addr += 4) *p ++ = ext_csd_read(addr);
+    read_ext_csd = false;
+    difftest_sync_mem(buf, SD_BLOCK_SIZE);
+  } else if (img) {
+    sdcard_data_rw(guest_to_host(buf), len);
+    if (write_cmd) sdcard_writeback(MS_ASYNC);
+    else difftest_sync_mem(buf, len);
+  }
+  hsts |= SDHSTS_BLOCK_IRPT;
+  if (base[SDHCFG] & SDHCFG_BLOCK_IRPT_EN) {
+    extern void dev_raise_intr();
+    dev_raise_intr();
+  }
+}
+
 static void sdcard_handle_cmd(int cmd) {
   switch (cmd) {
     case MMC_GO_IDLE_STATE: break;
@@ -82,7 +162,7 @@ static void sdcard_handle_cmd(int cmd) {
     case MMC_READ_MULTIPLE_BLOCK: prepare_rw(false); break;
     case MMC_WRITE_MULTIPLE_BLOCK: prepare_rw(true); break;
     case MMC_SEND_STATUS: base[SDRSP0] = 0x900; base[SDRSP1] = base[SDRSP2] = base[SDRSP3] = 0; break;
-    case MMC_STOP_TRANSMISSION: break;
+    case MMC_STOP_TRANSMISSION: sdcard_writeback(MS_ASYNC); break;
     default:
       panic("unhandled command = %d", cmd);
   }
@@ -100,22 +180,27 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
       break;
     case SDDATA:
        if (read_ext_csd) {
-         // See section 8.1 JEDEC Standard JED84-A441
-         uint32_t data;
-         switch (addr) {
-           case 192: data = 2; break; // EXT_CSD_REV
-           case 212: data = MEMORY_SIZE / 512; break;
-           default: data = 0;
-         }
-         base[SDDATA] = data;
+         base[SDDATA] = ext_csd_read(addr);
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else if (img) {
+         sdcard_data_rw(&base[SDDATA], 4);
        }
        addr += 4;
        break;
+    case SDHSTS:
+      if (is_write) hsts &= ~base[SDHSTS];
+      base[SDHSTS] = hsts;
+      break;
+    case SDHCFG:
+    case SDDMAADDR:
+    case SDDMACNT:
+      break;
+    case SDDMACTL:
+      if (is_write && (base[SDDMACTL] & 1)) {
+        sdcard_dma();
+        base[SDDMACTL] = 0;
+      }
+      break;
     default:
       Log("offset = 0x%x(idx = %d), is_write = %d, data = 0x%x", offset, idx, is_write, base[idx]);
       panic("unhandle offset = %d", offset);
@@ -128,7 +213,20 @@ void init_sdcard() {
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    Log("Can not find sdcard image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  img_size = st.st_size;
+  if (img_size > 0) {
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not mmap sdcard image: %s", path);
+    atexit(sdcard_sync);
+  }
+  close(fd);
 }
@@ -19,23 +19,157 @@
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
-#define CH_OFFSET 0
+#define CH_OFFSET  0
+#define IER_OFFSET 1
+#define IIR_OFFSET 2
+#define LSR_OFFSET 5
+
+#define IER_RDI   0x01 // received data available interrupt
+#define IIR_NONE  0x01 // no interrupt pending
+#define IIR_RDI   0x04
+#define LSR_DR    0x01 // data ready
+#define LSR_THRE  0x20 // transmitter holding register empty
+#define LSR_TEMT  0x40 // transmitter empty
 
 static uint8_t *serial_base = NULL;
 
+#ifndef CONFIG_TARGET_AM
+// Buffer the output of the guest, or every byte will cost a write
+// syscall since stderr is unbuffered. The buffer is flushed at the end
+// of a line, when it is full, and when NEMU stops or exits.
+#define SERIAL_BUF_SIZE 4096
+
+static FILE *serial_fp = NULL;
+static char serial_buf[SERIAL_BUF_SIZE];
+static int serial_buf_len = 0;
+
+void serial_flush() {
+  if (serial_buf_len > 0) {
+    fwrite(serial_buf, 1, serial_buf_len, serial_fp);
+    fflush(serial_fp);
+    serial_buf_len = 0;
+  }
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  serial_buf[serial_buf_len ++] = ch;
+  if (ch == '\n' || serial_buf_len == SERIAL_BUF_SIZE) serial_flush();
+}
+
+static void init_serial_output() {
+  const char *path = CONFIG_SERIAL_OUTPUT_PATH;
+  serial_fp = stderr;
+  if (path[0] != '\0') {
+    serial_fp = fopen(path, "w");
+    Assert(serial_fp, "Can not open '%s'", path);
+  }
+  atexit(serial_flush);
+}
+
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Input bytes are moved from the host FIFO into this ring buffer in
+// bulk with non-blocking reads, so the guest never waits for the host.
+#define SERIAL_FIFO_PATH "/tmp/nemu.serial"
+#define RX_QUEUE_LEN 65536
+
+static int rx_fd = -1;
+static uint8_t rx_queue[RX_QUEUE_LEN];
+static uint32_t rx_f = 0, rx_r = 0; // free-running, index with % RX_QUEUE_LEN
+
+static inline uint32_t rx_count() { return rx_r - rx_f; }
+
+static void rx_fill() {
+  uint32_t space = RX_QUEUE_LEN - rx_count();
+  while (space > 0) {
+    uint32_t r = rx_r % RX_QUEUE_LEN;
+    uint32_t n = (r + space > RX_QUEUE_LEN ? RX_QUEUE_LEN - r : space);
+    ssize_t ret = read(rx_fd, rx_queue + r, n);
+    if (ret <= 0) break; // no data (EAGAIN) or no writer (EOF)
+    rx_r += ret;
+    space -= ret;
+  }
+}
+
+// A guest polling LSR on an empty queue would otherwise make one read
+// syscall per poll, so the FIFO is checked at most once per millisecond.
+static bool serial_has_input() {
+  static uint64_t last = 0;
+  if (rx_count() == 0) {
+    uint64_t now = get_time();
+    if (now - last >= 1000) {
+      last = now;
+      rx_fill();
+    }
+  }
+  return rx_count() > 0;
+}
+
+static uint8_t serial_getc() {
+  return (serial_has_input() ? rx_queue[rx_f ++ % RX_QUEUE_LEN] : 0);
 }
 
+void serial_update() {
+  if ((serial_base[IER_OFFSET] & IER_RDI) && serial_has_input()) {
+    extern void dev_raise_intr();
+    dev_raise_intr();
+  }
+}
+
+static void init_serial_input() {
+  if (mkfifo(SERIAL_FIFO_PATH, 0666) != 0) {
+    struct stat st;
+    Assert(stat(SERIAL_FIFO_PATH, &st) == 0 && S_ISFIFO(st.st_mode),
+        "Can not create FIFO '%s'", SERIAL_FIFO_PATH);
+  }
+  rx_fd = open(SERIAL_FIFO_PATH, O_RDONLY | O_NONBLOCK);
+  Assert(rx_fd >= 0, "Can not open FIFO '%s'", SERIAL_FIFO_PATH);
+  Log("Serial input is read from %s", SERIAL_FIFO_PATH);
+}
+#endif
+#else
+void serial_flush() {}
+
+static void serial_putc(char ch) {
+  putch(ch);
+}
+#endif
+
+// Other console devices share the sink of the serial port.
+void serial_write(const char *buf, size_t len) {
+  for (size_t i = 0; i < len; i ++) serial_putc(buf[i]);
+}
+
+#ifndef CONFIG_SERIAL_INPUT_FIFO
+static bool serial_has_input() { return false; }
+static uint8_t serial_getc() { return 0; }
+#endif
+
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
   switch (offset) {
-    /* We bind the serial port with the host stderr in NEMU. */
+    /* We bind the serial port with the host stderr (or a file) in NEMU. */
     case CH_OFFSET:
       if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      else serial_base[0] = serial_getc();
+      break;
+    case IIR_OFFSET:
+      // writes go to FCR, and FIFOs are always enabled
+      if (!is_write) {
+        bool rdi = (serial_base[IER_OFFSET] & IER_RDI) && serial_has_input();
+        serial_base[IIR_OFFSET] = 0xc0 | (rdi ? IIR_RDI : IIR_NONE);
+      }
       break;
+    case LSR_OFFSET:
+      if (!is_write) {
+        serial_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT | (serial_has_input() ? LSR_DR : 0);
+      }
+      break;
+    case IER_OFFSET: case 3: case 4: case 6: case 7:
+      break; // IER, LCR, MCR, MSR and SCR have no side effects
     default: panic("do not support offset = %d", offset);
   }
 }
@@ -47,5 +181,7 @@ void init_serial() {
 #else
   add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
 #endif
-
+  serial_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT;
+  IFNDEF(CONFIG_TARGET_AM, init_serial_output());
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, init_serial_input());
 }
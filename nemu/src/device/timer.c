@@ -16,19 +16,32 @@
 #include <device/map.h>
 #include <device/alarm.h>
 #include <utils.h>
+#include <device/input-log.h>
 
 static uint32_t *rtc_port_base = NULL;
 
+// the uptime seen by the guest
+uint64_t rtc_get_us() {
+#ifdef CONFIG_INPUT_REPLAY
+  return input_replay(INPUT_TIME);
+#else
+  uint64_t us = get_time();
+  IFDEF(CONFIG_INPUT_RECORD, input_record(INPUT_TIME, us));
+  return us;
+#endif
+}
+
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    uint64_t us = rtc_get_us();
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
   }
 }
 
-#ifndef CONFIG_TARGET_AM
+// with the CLINT, timer interrupts come from mtimecmp instead
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_HAS_CLINT)
 static void timer_intr() {
   if (nemu_state.state == NEMU_RUNNING) {
     extern void dev_raise_intr();
@@ -44,5 +57,7 @@ void init_timer() {
 #else
   add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_HAS_CLINT)
+  add_alarm_handle(timer_intr);
+#endif
 }
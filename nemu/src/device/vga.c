@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <memory/paddr.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -34,6 +35,105 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+// 2D acceleration. The guest puts commands into a ring in its memory
+// and writes the new tail to reg_cmdq_tail. All commands up to the tail
+// are then executed as host loops over the frame buffer, and the head
+// is advanced. Rectangles are clipped to the screen.
+
+enum {
+  reg_size,       // (width << 16) | height
+  reg_sync,
+  reg_cmdq,       // guest physical address of the command ring
+  reg_cmdq_len,   // number of entries, must be a power of 2
+  reg_cmdq_head,  // read only, advanced by the device
+  reg_cmdq_tail,  // write to execute the commands before it
+  nr_reg
+};
+
+enum { GPU_CMD_FILL = 1, GPU_CMD_COPY, GPU_CMD_BLIT };
+
+typedef struct {
+  uint32_t op;
+  int32_t x, y, w, h;
+  // FILL: color; COPY: source x, y; BLIT: source address, stride in pixels
+  uint32_t arg[3];
+} GpuCmd;
+
+// Clip the rectangle at (x, y) to the screen, moving the
+// corresponding rectangle at (sx, sy) along with it.
+static bool clip_rect(int32_t *x, int32_t *y, int32_t *w, int32_t *h, int32_t *sx, int32_t *sy) {
+  int32_t W = screen_width(), H = screen_height();
+  if (*x < 0) { *w += *x; *sx -= *x; *x = 0; }
+  if (*y < 0) { *h += *y; *sy -= *y; *y = 0; }
+  if (*x + *w > W) *w = W - *x;
+  if (*y + *h > H) *h = H - *y;
+  return *w > 0 && *h > 0;
+}
+
+static void gpu_fill(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {
+  int32_t dummy = 0;
+  if (!clip_rect(&x, &y, &w, &h, &dummy, &dummy)) return;
+  uint32_t W = screen_width();
+  uint32_t *row = (uint32_t *)vmem + y * W + x;
+  for (int i = 0; i < w; i ++) row[i] = color;
+  for (int j = 1; j < h; j ++) memcpy(row + j * W, row, w * sizeof(uint32_t));
+}
+
+static void gpu_copy(int32_t x, int32_t y, int32_t w, int32_t h, int32_t sx, int32_t sy) {
+  if (!clip_rect(&x, &y, &w, &h, &sx, &sy)) return;
+  if (!clip_rect(&sx, &sy, &w, &h, &x, &y)) return;
+  uint32_t W = screen_width();
+  uint32_t *dst = (uint32_t *)vmem + y * W + x;
+  uint32_t *src = (uint32_t *)vmem + sy * W + sx;
+  // the two rectangles may overlap
+  if (y <= sy) {
+    for (int j = 0; j < h; j ++) memmove(dst + j * W, src + j * W, w * sizeof(uint32_t));
+  } else {
+    for (int j = h - 1; j >= 0; j --) memmove(dst + j * W, src + j * W, w * sizeof(uint32_t));
+  }
+}
+
+static void gpu_blit(int32_t x, int32_t y, int32_t w, int32_t h, paddr_t src, uint32_t stride) {
+  int32_t sx = 0, sy = 0;
+  if (w <= 0 || h <= 0) return;
+  // w is positive here, so the comparison is done on unsigned values
+  Assert(stride >= (uint32_t)w, "blit stride %u is less than width %d", stride, w);
+  uint64_t src_len = ((uint64_t)(h - 1) * stride + w) * sizeof(uint32_t);
+  Assert(in_pmem(src) && src_len <= CONFIG_MSIZE && in_pmem(src + src_len - 1),
+      "blit source " FMT_PADDR " is out of pmem", src);
+  if (!clip_rect(&x, &y, &w, &h, &sx, &sy)) return;
+  uint32_t W = screen_width();
+  uint32_t *dst = (uint32_t *)vmem + y * W + x;
+  uint32_t *s = (uint32_t *)guest_to_host(src) + sy * stride + sx;
+  for (int j = 0; j < h; j ++) memcpy(dst + j * W, s + j * stride, w * sizeof(uint32_t));
+}
+
+static void gpu_exec(GpuCmd *c) {
+  switch (c->op) {
+    case GPU_CMD_FILL: gpu_fill(c->x, c->y, c->w, c->h, c->arg[0]); break;
+    case GPU_CMD_COPY: gpu_copy(c->x, c->y, c->w, c->h, c->arg[0], c->arg[1]); break;
+    case GPU_CMD_BLIT: gpu_blit(c->x, c->y, c->w, c->h, c->arg[0], c->arg[1]); break;
+    default: panic("unknown GPU command %d", c->op);
+  }
+}
+
+static uint32_t cmdq_head = 0;
+
+static void gpu_process() {
+  uint32_t len = vgactl_port_base[reg_cmdq_len];
+  paddr_t q = vgactl_port_base[reg_cmdq];
+  Assert(len != 0 && (len & (len - 1)) == 0, "GPU command ring length %d is not a power of 2", len);
+  Assert(in_pmem(q) && in_pmem(q + len * sizeof(GpuCmd) - 1), "GPU command ring " FMT_PADDR " is out of pmem", q);
+  GpuCmd *ring = (GpuCmd *)guest_to_host(q);
+  uint32_t tail = vgactl_port_base[reg_cmdq_tail];
+  // a bad tail would otherwise run the ring around for up to 2^32 commands
+  Assert(tail - cmdq_head <= len, "GPU command tail %u is more than %u entries ahead of head %u",
+      tail, len, cmdq_head);
+  for (; cmdq_head != tail; cmdq_head ++) {
+    gpu_exec(&ring[cmdq_head & (len - 1)]);
+  }
+}
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
@@ -69,24 +169,127 @@ static inline void update_screen() {
   io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
 }
 #endif
+#elif defined(CONFIG_VGA_HEADLESS)
+// No window is created in headless mode. Every N-th synced frame is
+// hashed, and optionally streamed to a file or a pipe, so that the
+// output of a program can be checked without a display.
+
+static FILE *capture_fp = NULL;
+static bool capture_is_pipe = false;
+static FILE *hash_fp = NULL;
+static uint64_t nr_frame = 0;
+#ifdef CONFIG_VGA_CAPTURE_PPM
+static uint8_t ppm_buf[SCREEN_W * SCREEN_H * 3];
+#endif
+
+// 64-bit FNV-1a
+static uint64_t frame_hash(const uint8_t *p, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < n; i ++) {
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+static void capture_frame() {
+#ifdef CONFIG_VGA_CAPTURE_PPM
+  uint32_t *px = vmem;
+  for (int i = 0; i < SCREEN_W * SCREEN_H; i ++) {
+    ppm_buf[i * 3 + 0] = px[i] >> 16;
+    ppm_buf[i * 3 + 1] = px[i] >> 8;
+    ppm_buf[i * 3 + 2] = px[i];
+  }
+  fprintf(capture_fp, "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H);
+  fwrite(ppm_buf, sizeof(ppm_buf), 1, capture_fp);
+#else
+  fwrite(vmem, screen_size(), 1, capture_fp);
+#endif
+}
+
+static inline void update_screen() {
+  uint64_t n = nr_frame ++;
+  if (n % CONFIG_VGA_CAPTURE_INTERVAL != 0) return;
+  if (hash_fp != NULL) {
+    fprintf(hash_fp, "%" PRIu64 " %016" PRIx64 "\n", n, frame_hash(vmem, screen_size()));
+  }
+  if (capture_fp != NULL) capture_frame();
+}
+
+static void close_capture() {
+  // a frame synced in the last instructions
+  if (vgactl_port_base[reg_sync] != 0) {
+    update_screen();
+    vgactl_port_base[reg_sync] = 0;
+  }
+  if (capture_fp != NULL) {
+    if (capture_is_pipe) pclose(capture_fp);
+    else fclose(capture_fp);
+    capture_fp = NULL;
+  }
+  if (hash_fp != NULL) {
+    fclose(hash_fp);
+    hash_fp = NULL;
+  }
+}
+
+static void init_screen() {
+  const char *path = CONFIG_VGA_CAPTURE_PATH;
+  if (path[0] == '|') {
+    capture_fp = popen(path + 1, "w");
+    capture_is_pipe = true;
+  } else if (path[0] != '\0') {
+    capture_fp = fopen(path, "wb");
+  }
+  if (path[0] != '\0') {
+    Assert(capture_fp, "Can not open '%s' to capture frames", path);
+    // frames are large, avoid splitting them into many small writes
+    setvbuf(capture_fp, NULL, _IOFBF, 1 << 20);
+  }
+
+  const char *hash_path = CONFIG_VGA_CAPTURE_HASH_PATH;
+  if (hash_path[0] != '\0') {
+    hash_fp = fopen(hash_path, "w");
+    Assert(hash_fp, "Can not open '%s' to record frame hashes", hash_path);
+  }
+
+  atexit(close_capture);
+  Log("VGA headless mode, capture every %d frame(s) to %s",
+      CONFIG_VGA_CAPTURE_INTERVAL, path[0] != '\0' ? path : "nowhere");
+}
+
 #endif
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_HEADLESS)
+  if (vgactl_port_base[reg_sync] != 0) {
+    update_screen();
+    vgactl_port_base[reg_sync] = 0;
+  }
+#endif
+}
+
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == reg_cmdq_tail * sizeof(uint32_t)) gpu_process();
+  if (!is_write && offset == reg_cmdq_head * sizeof(uint32_t)) vgactl_port_base[reg_cmdq_head] = cmdq_head;
+  // without a display every synced frame is captured, not only
+  // the ones that are still pending at the next refresh
+  IFDEF(CONFIG_VGA_HEADLESS, if (is_write && offset == reg_sync * sizeof(uint32_t)) vga_update_screen());
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
-  vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  vgactl_port_base = (uint32_t *)new_space(space_size);
+  vgactl_port_base[reg_size] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, space_size, vgactl_io_handler);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, space_size, vgactl_io_handler);
 #endif
 
   vmem = new_space(screen_size());
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
   IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  IFDEF(CONFIG_VGA_HEADLESS, init_screen());
+  IFDEF(CONFIG_VGA_HEADLESS, memset(vmem, 0, screen_size()));
 }
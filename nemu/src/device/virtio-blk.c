@@ -0,0 +1,128 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "virtio.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// A request is a header, any number of data buffers and a status byte.
+// Data is copied directly between the mmap()ed image and guest memory.
+
+#define SECTOR_SIZE 512
+
+#define VIRTIO_BLK_T_IN     0
+#define VIRTIO_BLK_T_OUT    1
+#define VIRTIO_BLK_T_FLUSH  4
+#define VIRTIO_BLK_T_GET_ID 8
+
+#define VIRTIO_BLK_S_OK     0
+#define VIRTIO_BLK_S_IOERR  1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+#define VIRTIO_BLK_F_FLUSH  9
+
+typedef struct {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} VirtioBlkReq;
+
+static uint8_t *img = NULL;
+static size_t img_size = 0;
+
+static uint8_t blk_rw(VirtioBlkReq *req, VirtioBuf *data, int nr_data, uint32_t *written) {
+  bool is_write = (req->type == VIRTIO_BLK_T_OUT);
+  uint64_t off = req->sector * SECTOR_SIZE;
+  for (int i = 0; i < nr_data; i ++) {
+    if (data[i].is_write == is_write) return VIRTIO_BLK_S_IOERR;
+    if (off + data[i].len > img_size) return VIRTIO_BLK_S_IOERR;
+    if (is_write) memcpy(img + off, data[i].buf, data[i].len);
+    else { memcpy(data[i].buf, img + off, data[i].len); *written += data[i].len; }
+    off += data[i].len;
+  }
+  return VIRTIO_BLK_S_OK;
+}
+
+static int blk_handler(int qidx, VirtioBuf *buf, int nr_buf) {
+  Assert(nr_buf >= 2 && buf[0].len >= sizeof(VirtioBlkReq) && !buf[0].is_write &&
+      buf[nr_buf - 1].len >= 1 && buf[nr_buf - 1].is_write, "virtio-blk: malformed request");
+  VirtioBlkReq *req = (VirtioBlkReq *)buf[0].buf;
+  VirtioBuf *data = buf + 1;
+  int nr_data = nr_buf - 2;
+  uint32_t written = 0;
+  uint8_t status;
+
+  switch (req->type) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT: status = blk_rw(req, data, nr_data, &written); break;
+    case VIRTIO_BLK_T_FLUSH:
+      status = (img == NULL || msync(img, img_size, MS_SYNC) == 0) ? VIRTIO_BLK_S_OK : VIRTIO_BLK_S_IOERR;
+      break;
+    case VIRTIO_BLK_T_GET_ID:
+      if (nr_data > 0 && data[0].is_write) {
+        static const char id[20] = "nemu-virtio-blk";
+        written = (data[0].len < sizeof(id) ? data[0].len : sizeof(id));
+        memcpy(data[0].buf, id, written);
+        status = VIRTIO_BLK_S_OK;
+      } else status = VIRTIO_BLK_S_IOERR;
+      break;
+    default: status = VIRTIO_BLK_S_UNSUPP; break;
+  }
+
+  *buf[nr_buf - 1].buf = status;
+  return written + 1;
+}
+
+static VirtioDev blk = {
+  .name = "virtio-blk",
+  .device_id = VIRTIO_ID_BLOCK,
+  .features = 1ull << VIRTIO_BLK_F_FLUSH,
+  .nr_queue = 1,
+  .handler = blk_handler,
+};
+
+static void blk_io_handler(uint32_t offset, int len, bool is_write) {
+  virtio_mmio_access(&blk, offset, len, is_write);
+}
+
+static void init_blk_img(const char *path) {
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    Log("Can not find virtio-blk image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  img_size = st.st_size / SECTOR_SIZE * SECTOR_SIZE;
+  if (img_size > 0) {
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not mmap virtio-blk image: %s", path);
+  }
+  close(fd);
+  Log("virtio-blk image: %s, %zu sectors", path, img_size / SECTOR_SIZE);
+}
+
+void init_virtio_blk() {
+  virtio_mmio_init(&blk, CONFIG_VIRTIO_BLK_MMIO, blk_io_handler);
+
+  const char *path = CONFIG_VIRTIO_BLK_IMG_PATH;
+  if (path[0] != '\0') init_blk_img(path);
+
+  // capacity in sectors
+  *(uint64_t *)blk.config = img_size / SECTOR_SIZE;
+}
@@ -0,0 +1,52 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "virtio.h"
+
+// Each transmit buffer is passed to the output sink at once, instead of
+// one MMIO access per character as with the serial port. The sink is the
+// one of the serial port, so the output honors SERIAL_OUTPUT_PATH.
+// There is no input source yet, so receive buffers stay in the queue.
+
+enum { RX_QUEUE, TX_QUEUE, NR_QUEUE };
+
+#ifdef CONFIG_HAS_SERIAL
+void serial_write(const char *buf, size_t len);
+#else
+static void serial_write(const char *buf, size_t len) { fwrite(buf, 1, len, stderr); }
+#endif
+
+static int console_handler(int qidx, VirtioBuf *buf, int nr_buf) {
+  if (qidx == RX_QUEUE) return -1;
+  for (int i = 0; i < nr_buf; i ++) {
+    if (!buf[i].is_write) serial_write((const char *)buf[i].buf, buf[i].len);
+  }
+  return 0;
+}
+
+static VirtioDev console = {
+  .name = "virtio-console",
+  .device_id = VIRTIO_ID_CONSOLE,
+  .nr_queue = NR_QUEUE,
+  .handler = console_handler,
+};
+
+static void console_io_handler(uint32_t offset, int len, bool is_write) {
+  virtio_mmio_access(&console, offset, len, is_write);
+}
+
+void init_virtio_console() {
+  virtio_mmio_init(&console, CONFIG_VIRTIO_CONSOLE_MMIO, console_io_handler);
+}
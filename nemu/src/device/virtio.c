@@ -0,0 +1,196 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <memory/paddr.h>
+#include "virtio.h"
+
+// The driver places any number of requests into the available ring and
+// notifies the device once. All of them are then handled in one batch,
+// working directly on the rings in guest memory. Completion is signaled
+// by setting bit 0 of InterruptStatus and raising the shared external
+// interrupt line (see intr.c); the driver acks it via InterruptACK.
+
+#define VIRTIO_MAGIC  0x74726976 // "virt"
+#define VIRTIO_VENDOR 0x554d454e // "NEMU"
+
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2
+
+typedef struct {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} VirtqDesc;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[];
+} VirtqAvail;
+
+typedef struct {
+  uint32_t id;
+  uint32_t len;
+} VirtqUsedElem;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  VirtqUsedElem ring[];
+} VirtqUsed;
+
+#define REG(dev, off) (*(uint32_t *)((dev)->base + (off)))
+
+static void *guest_ptr(uint64_t addr, uint64_t len) {
+  Assert(len <= CONFIG_MSIZE && addr >= PMEM_LEFT && addr + len <= (uint64_t)PMEM_RIGHT + 1,
+      "virtio: buffer [%#" PRIx64 ", +%#" PRIx64 ") is out of pmem", addr, len);
+  return guest_to_host(addr);
+}
+
+static VirtQueue* sel_queue(VirtioDev *dev) {
+  Assert(dev->queue_sel < dev->nr_queue, "%s: queue %d does not exist", dev->name, dev->queue_sel);
+  return &dev->queue[dev->queue_sel];
+}
+
+static void virtio_reset(VirtioDev *dev) {
+  dev->status = 0;
+  dev->int_status = 0;
+  dev->features_sel = dev->driver_features_sel = 0;
+  dev->driver_features = 0;
+  dev->queue_sel = 0;
+  memset(dev->queue, 0, sizeof(dev->queue));
+}
+
+static inline void set_low(uint64_t *reg, uint32_t val) { *reg = (*reg & ~0xffffffffull) | val; }
+static inline void set_high(uint64_t *reg, uint32_t val) { *reg = (*reg & 0xffffffffull) | ((uint64_t)val << 32); }
+
+void virtio_queue_process(VirtioDev *dev, int qidx) {
+  if (qidx >= dev->nr_queue) return;
+  VirtQueue *q = &dev->queue[qidx];
+  if (!q->ready || !(dev->status & 0x4)) return; // DRIVER_OK
+
+  VirtqDesc *desc = guest_ptr(q->desc, sizeof(VirtqDesc) * q->num);
+  VirtqAvail *avail = guest_ptr(q->avail, sizeof(VirtqAvail) + sizeof(uint16_t) * q->num);
+  VirtqUsed *used = guest_ptr(q->used, sizeof(VirtqUsed) + sizeof(VirtqUsedElem) * q->num);
+
+  VirtioBuf buf[VIRTIO_MAX_SEG];
+  int nr_done = 0;
+  while (q->last_avail != avail->idx) {
+    uint16_t head = avail->ring[q->last_avail % q->num];
+    int n = 0;
+    uint16_t i = head;
+    while (true) {
+      Assert(i < q->num && n < VIRTIO_MAX_SEG, "%s: bad descriptor chain from %d", dev->name, head);
+      VirtqDesc *d = &desc[i];
+      buf[n].buf = (d->len == 0 ? NULL : guest_ptr(d->addr, d->len));
+      buf[n].len = d->len;
+      buf[n].is_write = (d->flags & VIRTQ_DESC_F_WRITE) != 0;
+      n ++;
+      if (!(d->flags & VIRTQ_DESC_F_NEXT)) break;
+      i = d->next;
+    }
+
+    int ret = dev->handler(qidx, buf, n);
+    if (ret < 0) break;
+    for (int k = 0; k < n; k ++) {
+      if (buf[k].is_write && buf[k].len > 0) difftest_sync_mem(host_to_guest(buf[k].buf), buf[k].len);
+    }
+
+    VirtqUsedElem *e = &used->ring[used->idx % q->num];
+    e->id = head;
+    e->len = ret;
+    used->idx ++;
+    q->last_avail ++;
+    nr_done ++;
+  }
+
+  if (nr_done > 0) {
+    difftest_sync_mem(q->used, sizeof(VirtqUsed) + sizeof(VirtqUsedElem) * q->num);
+    dev->int_status |= 0x1; // used buffer notification
+    extern void dev_raise_intr();
+    dev_raise_intr();
+  }
+}
+
+void virtio_mmio_access(VirtioDev *dev, uint32_t offset, int len, bool is_write) {
+  // the configuration space is plain memory maintained by the device
+  if (offset >= VIRTIO_MMIO_CONFIG) return;
+  Assert(len == 4 && offset % 4 == 0, "%s: unaligned access at offset %#x", dev->name, offset);
+
+  if (!is_write) {
+    uint32_t val = 0;
+    switch (offset) {
+      case VIRTIO_MMIO_MAGIC_VALUE: val = VIRTIO_MAGIC; break;
+      case VIRTIO_MMIO_VERSION: val = 2; break;
+      case VIRTIO_MMIO_DEVICE_ID: val = dev->device_id; break;
+      case VIRTIO_MMIO_VENDOR_ID: val = VIRTIO_VENDOR; break;
+      case VIRTIO_MMIO_DEVICE_FEATURES:
+        val = (dev->features_sel < 2 ? dev->features >> (32 * dev->features_sel) : 0); break;
+      case VIRTIO_MMIO_QUEUE_NUM_MAX:
+        val = (dev->queue_sel < dev->nr_queue ? VIRTIO_QUEUE_NUM_MAX : 0); break;
+      case VIRTIO_MMIO_QUEUE_READY:
+        val = (dev->queue_sel < dev->nr_queue ? dev->queue[dev->queue_sel].ready : 0); break;
+      case VIRTIO_MMIO_INTERRUPT_STATUS: val = dev->int_status; break;
+      case VIRTIO_MMIO_STATUS: val = dev->status; break;
+      default: break;
+    }
+    REG(dev, offset) = val;
+    return;
+  }
+
+  uint32_t val = REG(dev, offset);
+  switch (offset) {
+    case VIRTIO_MMIO_DEVICE_FEATURES_SEL: dev->features_sel = val; break;
+    case VIRTIO_MMIO_DRIVER_FEATURES_SEL: dev->driver_features_sel = val; break;
+    case VIRTIO_MMIO_DRIVER_FEATURES:
+      if (dev->driver_features_sel == 0) set_low(&dev->driver_features, val);
+      else if (dev->driver_features_sel == 1) set_high(&dev->driver_features, val);
+      break;
+    case VIRTIO_MMIO_QUEUE_SEL: dev->queue_sel = val; break;
+    case VIRTIO_MMIO_QUEUE_NUM:
+      Assert(val != 0 && val <= VIRTIO_QUEUE_NUM_MAX && (val & (val - 1)) == 0,
+          "%s: bad queue size %d", dev->name, val);
+      sel_queue(dev)->num = val;
+      break;
+    case VIRTIO_MMIO_QUEUE_READY:
+      Assert(!(val & 0x1) || sel_queue(dev)->num != 0, "%s: queue %d is ready before its size is set",
+          dev->name, dev->queue_sel);
+      sel_queue(dev)->ready = val & 0x1;
+      break;
+    case VIRTIO_MMIO_QUEUE_NOTIFY: virtio_queue_process(dev, val); break;
+    case VIRTIO_MMIO_INTERRUPT_ACK: dev->int_status &= ~val; break;
+    case VIRTIO_MMIO_STATUS:
+      if (val == 0) virtio_reset(dev);
+      else dev->status = val;
+      break;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW:   set_low (&sel_queue(dev)->desc, val); break;
+    case VIRTIO_MMIO_QUEUE_DESC_HIGH:  set_high(&sel_queue(dev)->desc, val); break;
+    case VIRTIO_MMIO_QUEUE_AVAIL_LOW:  set_low (&sel_queue(dev)->avail, val); break;
+    case VIRTIO_MMIO_QUEUE_AVAIL_HIGH: set_high(&sel_queue(dev)->avail, val); break;
+    case VIRTIO_MMIO_QUEUE_USED_LOW:   set_low (&sel_queue(dev)->used, val); break;
+    case VIRTIO_MMIO_QUEUE_USED_HIGH:  set_high(&sel_queue(dev)->used, val); break;
+    default: break;
+  }
+}
+
+void virtio_mmio_init(VirtioDev *dev, paddr_t addr, io_callback_t callback) {
+  Assert(dev->nr_queue <= VIRTIO_MAX_QUEUE, "%s: too many queues", dev->name);
+  dev->base = new_space(VIRTIO_MMIO_SPACE_SIZE);
+  dev->config = dev->base + VIRTIO_MMIO_CONFIG;
+  dev->features |= 1ull << VIRTIO_F_VERSION_1;
+  virtio_reset(dev);
+  add_mmio_map(dev->name, addr, dev->base, VIRTIO_MMIO_SPACE_SIZE, callback);
+}
@@ -0,0 +1,99 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __VIRTIO_H__
+#define __VIRTIO_H__
+
+#include <device/map.h>
+
+// A subset of the virtio-mmio transport (version 2) with split virtqueues.
+// Only the features needed by the AM driver are implemented: no indirect
+// descriptors, no event index, no notification suppression.
+
+#define VIRTIO_MMIO_MAGIC_VALUE         0x000
+#define VIRTIO_MMIO_VERSION             0x004
+#define VIRTIO_MMIO_DEVICE_ID           0x008
+#define VIRTIO_MMIO_VENDOR_ID           0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES     0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES     0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL           0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_MMIO_QUEUE_NUM           0x038
+#define VIRTIO_MMIO_QUEUE_READY         0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS    0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK       0x064
+#define VIRTIO_MMIO_STATUS              0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084
+#define VIRTIO_MMIO_QUEUE_AVAIL_LOW     0x090
+#define VIRTIO_MMIO_QUEUE_AVAIL_HIGH    0x094
+#define VIRTIO_MMIO_QUEUE_USED_LOW      0x0a0
+#define VIRTIO_MMIO_QUEUE_USED_HIGH     0x0a4
+#define VIRTIO_MMIO_CONFIG_GENERATION   0x0fc
+#define VIRTIO_MMIO_CONFIG              0x100
+#define VIRTIO_MMIO_SPACE_SIZE          0x200
+
+#define VIRTIO_ID_BLOCK   2
+#define VIRTIO_ID_CONSOLE 3
+
+#define VIRTIO_F_VERSION_1 32
+
+#define VIRTIO_QUEUE_NUM_MAX 256
+#define VIRTIO_MAX_QUEUE     2
+#define VIRTIO_MAX_SEG       64
+
+// a descriptor of a request, already translated to a host pointer
+typedef struct {
+  uint8_t *buf;
+  uint32_t len;
+  bool is_write;  // writable by the device
+} VirtioBuf;
+
+// Handle the request made of `nr_buf` buffers on queue `qidx`.
+// Return the number of bytes written into the device-writable buffers,
+// or -1 to leave the request (and all requests after it) in the queue.
+typedef int (*virtio_handler_t)(int qidx, VirtioBuf *buf, int nr_buf);
+
+typedef struct {
+  uint32_t num;
+  bool ready;
+  uint64_t desc, avail, used;
+  uint16_t last_avail;
+} VirtQueue;
+
+typedef struct {
+  const char *name;
+  uint32_t device_id;
+  uint64_t features;
+  int nr_queue;
+  virtio_handler_t handler;
+  uint8_t *base;
+  uint8_t *config;   // device specific configuration space, inside `base`
+
+  uint32_t status, int_status;
+  uint32_t features_sel, driver_features_sel;
+  uint64_t driver_features;
+  uint32_t queue_sel;
+  VirtQueue queue[VIRTIO_MAX_QUEUE];
+} VirtioDev;
+
+void virtio_mmio_init(VirtioDev *dev, paddr_t addr, io_callback_t callback);
+void virtio_mmio_access(VirtioDev *dev, uint32_t offset, int len, bool is_write);
+void virtio_queue_process(VirtioDev *dev, int qidx);
+
+#endif
@@ -26,6 +26,12 @@ const char *regs[] = {
 void isa_reg_display() {
 }
 
+void isa_reg_log_change(FILE *fp, const CPU_state *prev) {
+  for (int i = 0; i < ARRLEN(cpu.gpr); i ++) {
+    if (cpu.gpr[i] != prev->gpr[i]) fprintf(fp, "  %s = " FMT_WORD "\n", regs[i], cpu.gpr[i]);
+  }
+}
+
 word_t isa_reg_str2val(const char *s, bool *success) {
   return 0;
 }
@@ -17,6 +17,7 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/difftest.h>
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
@@ -45,6 +46,32 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
   }
 }
 
+// The pending bits of mip are set by devices only. The REF has no
+// devices, so the value read from mip is passed to it, and it is read
+// from the log when a difftest failure is replayed.
+static word_t csr_rw(int no, word_t val, int op) {
+  word_t *p = csr(no & 0xfff);
+  word_t old = *p;
+  if (p == &cpu.csr.mip) {
+    difftest_skip_ref();
+    old = difftest_input(old);
+  } else {
+    switch (op) {
+      case 1: *p = val; break;        // csrrw
+      case 2: *p = old | val; break;  // csrrs
+      case 3: *p = old & ~val; break; // csrrc
+    }
+  }
+  return old;
+}
+
+static vaddr_t mret() {
+  word_t s = cpu.csr.mstatus;
+  s = (s & ~MSTATUS_MIE) | ((s & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+  cpu.csr.mstatus = s | MSTATUS_MPIE;
+  return cpu.csr.mepc;
+}
+
 static int decode_exec(Decode *s) {
   int rd = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
@@ -61,7 +88,12 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
 
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, R(rd) = csr_rw(imm, src1, 1));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, R(rd) = csr_rw(imm, src1, 2));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc  , I, R(rd) = csr_rw(imm, src1, 3));
+
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = mret());
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
@@ -16,7 +16,7 @@
 #ifndef __RISCV_REG_H__
 #define __RISCV_REG_H__
 
-#include <common.h>
+#include <isa.h>
 
 static inline int check_reg_idx(int idx) {
   IFDEF(CONFIG_RT_CHECK, assert(idx >= 0 && idx < MUXDEF(CONFIG_RVE, 16, 32)));
@@ -30,4 +30,21 @@ static inline const char* reg_name(int idx) {
   return regs[check_reg_idx(idx)];
 }
 
+enum {
+  CSR_MSTATUS = 0x300, CSR_MIE = 0x304, CSR_MTVEC = 0x305,
+  CSR_MEPC = 0x341, CSR_MCAUSE = 0x342, CSR_MIP = 0x344,
+};
+
+static inline word_t* csr(int no) {
+  switch (no) {
+    case CSR_MSTATUS: return &cpu.csr.mstatus;
+    case CSR_MIE:     return &cpu.csr.mie;
+    case CSR_MTVEC:   return &cpu.csr.mtvec;
+    case CSR_MEPC:    return &cpu.csr.mepc;
+    case CSR_MCAUSE:  return &cpu.csr.mcause;
+    case CSR_MIP:     return &cpu.csr.mip;
+    default: panic("unsupported CSR %#x at pc = " FMT_WORD, no, cpu.pc);
+  }
+}
+
 #endif
@@ -32,6 +32,24 @@ void isa_reg_display() {
   {
     printf("%-4s  0x%08x    %-8d\n", regs[i], cpu.gpr[i], cpu.gpr[i]);
   }
+  printf("mstatus 0x%08x  mie 0x%08x  mip 0x%08x\n", cpu.csr.mstatus, cpu.csr.mie, cpu.csr.mip);
+  printf("mtvec   0x%08x  mepc 0x%08x  mcause 0x%08x\n", cpu.csr.mtvec, cpu.csr.mepc, cpu.csr.mcause);
+}
+
+// log the registers changed since `prev`, one per line
+void isa_reg_log_change(FILE *fp, const CPU_state *prev) {
+  for (int i = 0; i < ARRLEN(cpu.gpr); i ++) {
+    if (cpu.gpr[i] != prev->gpr[i]) fprintf(fp, "  %s = " FMT_WORD "\n", regs[i], cpu.gpr[i]);
+  }
+#define LOG_CSR(name) \
+  if (cpu.csr.name != prev->csr.name) fprintf(fp, "  " #name " = " FMT_WORD "\n", cpu.csr.name)
+  LOG_CSR(mstatus);
+  LOG_CSR(mie);
+  LOG_CSR(mip);
+  LOG_CSR(mtvec);
+  LOG_CSR(mepc);
+  LOG_CSR(mcause);
+#undef LOG_CSR
 }
 
 word_t isa_reg_str2val(const char *s, bool *success)
@@ -15,14 +15,28 @@
 
 #include <isa.h>
 
-word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+#define INTR_BIT ((word_t)1 << (sizeof(word_t) * 8 - 1))
+#define IRQ_MSIP (INTR_BIT | 3)
+#define IRQ_MTIP (INTR_BIT | 7)
+#define IRQ_MEIP (INTR_BIT | 11)
 
-  return 0;
+word_t isa_raise_intr(word_t NO, vaddr_t epc) {
+  cpu.csr.mcause = NO;
+  cpu.csr.mepc = epc;
+  word_t s = cpu.csr.mstatus;
+  s = (s & ~MSTATUS_MPIE) | ((s & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+  cpu.csr.mstatus = (s & ~MSTATUS_MIE) | MSTATUS_MPP;
+  return cpu.csr.mtvec & ~(word_t)0x3; // only the direct mode is supported
 }
 
 word_t isa_query_intr() {
+  if (!(cpu.csr.mstatus & MSTATUS_MIE)) return INTR_EMPTY;
+  word_t pending = cpu.csr.mip & cpu.csr.mie;
+  if (pending & MIP_MEIP) {
+    cpu.csr.mip &= ~MIP_MEIP;
+    return IRQ_MEIP;
+  }
+  if (pending & MIP_MSIP) return IRQ_MSIP;
+  if (pending & MIP_MTIP) return IRQ_MTIP;
   return INTR_EMPTY;
 }
@@ -17,6 +17,8 @@
 #include <memory/paddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#include <cpu/difftest.h>
+#include <memory/snapshot.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
@@ -33,6 +35,10 @@ static word_t pmem_read(paddr_t addr, int len) {
 }
 
 static void pmem_write(paddr_t addr, int len, word_t data) {
+#if CONFIG_DIFFTEST_BATCH > 1 || CONFIG_DIFFTEST_MEM_INTERVAL > 0
+  difftest_log_store(addr, len);
+#endif
+  IFDEF(CONFIG_MEM_SNAPSHOT, if (snapshot_active) snapshot_log_store(addr, len));
   host_write(guest_to_host(addr), len, data);
 }
 
@@ -50,14 +56,35 @@ void init_mem() {
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
-word_t paddr_read(paddr_t addr, int len) {
+#ifdef CONFIG_DIFFTEST_REPLAY
+bool mtrace_on = false;
+
+static void mtrace(const char *type, paddr_t addr, int len, word_t data) {
+  extern FILE *log_fp;
+  fprintf(log_fp, "  %s " FMT_PADDR ", len = %d, data = " FMT_WORD "\n", type, addr, len, data);
+}
+#endif
+
+static inline word_t do_paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
   out_of_bound(addr);
   return 0;
 }
 
+word_t paddr_read(paddr_t addr, int len) {
+  word_t data = do_paddr_read(addr, len);
+  IFDEF(CONFIG_DIFFTEST_REPLAY, if (unlikely(mtrace_on)) mtrace("read ", addr, len, data));
+  return data;
+}
+
+// the same as paddr_read(), but not traced
+word_t paddr_ifetch(paddr_t addr, int len) {
+  return do_paddr_read(addr, len);
+}
+
 void paddr_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_DIFFTEST_REPLAY, if (unlikely(mtrace_on)) mtrace("write", addr, len, data));
   if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
@@ -0,0 +1,64 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <memory/paddr.h>
+#include <memory/snapshot.h>
+
+#define SNAP_PAGE_SIZE 4096
+#define NR_PAGE (CONFIG_MSIZE / SNAP_PAGE_SIZE)
+
+bool snapshot_active = false;
+
+// A page buffer is kept once allocated, and holds the page of the
+// current snapshot if its generation is the current one.
+static uint8_t *saved[NR_PAGE] = {};
+static uint32_t saved_gen[NR_PAGE] = {};
+static uint32_t saved_list[NR_PAGE];
+static int nr_saved = 0;
+static uint32_t gen = 0;
+
+static inline uint8_t* page_host(int idx) {
+  return guest_to_host(CONFIG_MBASE + idx * SNAP_PAGE_SIZE);
+}
+
+void snapshot_take() {
+  gen ++;
+  nr_saved = 0;
+  snapshot_active = true;
+}
+
+void snapshot_log_store(paddr_t addr, size_t len) {
+  int first = (addr - CONFIG_MBASE) / SNAP_PAGE_SIZE;
+  int last = (addr + len - 1 - CONFIG_MBASE) / SNAP_PAGE_SIZE;
+  for (int idx = first; idx <= last; idx ++) {
+    if (saved_gen[idx] == gen) continue;
+    if (saved[idx] == NULL) {
+      saved[idx] = malloc(SNAP_PAGE_SIZE);
+      assert(saved[idx]);
+    }
+    memcpy(saved[idx], page_host(idx), SNAP_PAGE_SIZE);
+    saved_gen[idx] = gen;
+    saved_list[nr_saved ++] = idx;
+  }
+}
+
+// the snapshot stays valid, so it can be restored again
+void snapshot_restore() {
+  Assert(snapshot_active, "there is no snapshot to restore");
+  for (int i = 0; i < nr_saved; i ++) {
+    int idx = saved_list[i];
+    memcpy(page_host(idx), saved[idx], SNAP_PAGE_SIZE);
+  }
+}
@@ -17,7 +17,7 @@
 #include <memory/paddr.h>
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  return paddr_ifetch(addr, len);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
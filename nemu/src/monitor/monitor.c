@@ -15,11 +15,12 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <cpu/difftest.h>
 
 void init_rand();
 void init_log(const char *log_file);
 void init_mem();
-void init_difftest(char *ref_so_file, long img_size, int port);
+void init_difftest(char **ref_so_file, int nr, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm(const char *triple);
@@ -42,7 +43,9 @@ static void welcome() {
 void sdb_set_batch_mode();
 
 static char *log_file = NULL;
-static char *diff_so_file = NULL;
+// `--diff` can be given several times
+static char *diff_so_file[DIFFTEST_MAX_REF] = {};
+static int nr_diff_so_file = 0;
 static char *img_file = NULL;
 static int difftest_port = 1234;
 
@@ -83,13 +86,16 @@ static int parse_args(int argc, char *argv[]) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
-      case 'd': diff_so_file = optarg; break;
+      case 'd':
+        Assert(nr_diff_so_file < ARRLEN(diff_so_file), "too many REFs");
+        diff_so_file[nr_diff_so_file ++] = optarg;
+        break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
         printf("\t-b,--batch              run with batch mode\n");
         printf("\t-l,--log=FILE           output log to FILE\n");
-        printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
+        printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO, can be repeated\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
         printf("\n");
         exit(0);
@@ -123,7 +129,7 @@ void init_monitor(int argc, char *argv[]) {
   long img_size = load_img();
 
   /* Initialize differential testing. */
-  init_difftest(diff_so_file, img_size, difftest_port);
+  init_difftest(diff_so_file, nr_diff_so_file, img_size, difftest_port);
 
   /* Initialize the simple debugger. */
   init_sdb();
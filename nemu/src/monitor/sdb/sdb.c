@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "sdb.h"
@@ -25,6 +26,7 @@ static int is_batch_mode = false;
 
 void init_regex();
 void init_wp_pool();
+void dev_stat_display();
 
 /* We use the `readline' library to provide more flexibility to read from stdin. */
 static char* rl_gets() {
@@ -88,10 +90,15 @@ static int cmd_info(char *args)
   {
     // TODO: watchpoint
   }
+  else if (strcmp(arg, "dev") == 0)
+  {
+    // print access statistics of devices
+    MUXDEF(CONFIG_DEVICE, dev_stat_display(), printf("Devices are not enabled.\n"));
+  }
   else
   {
     // exceptions
-    printf("Error argument input: r for Registers, w for watch points.\n");
+    printf("Error argument input: r for Registers, w for watch points, dev for Devices.\n");
   }
 
   return 0;
@@ -141,6 +148,16 @@ static int cmd_p(char *args)
   return 0;
 }
 
+static int cmd_detach(char *args) {
+  difftest_detach();
+  return 0;
+}
+
+static int cmd_attach(char *args) {
+  difftest_attach();
+  return 0;
+}
+
 static int cmd_help(char *args);
 
 static struct {
@@ -152,9 +169,11 @@ static struct {
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
   { "si", "Execute ONE single step instruction", cmd_si },
-  { "info", "Print the status of Registers / Watchpoints", cmd_info },
+  { "info", "Print the status of Registers / Watchpoints / Devices", cmd_info },
   { "x", "Scan the memory", cmd_x },
   { "p", "Calculate the value of Expression", cmd_p },
+  { "detach", "Stop the differential testing", cmd_detach },
+  { "attach", "Resume the differential testing from the current state", cmd_attach },
   // { "w", "", cmd_w },
   // { "d", "", cmd_d },
 
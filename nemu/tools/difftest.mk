@@ -18,6 +18,8 @@ DIFF_REF_PATH = $(NEMU_HOME)/$(call remove_quote,$(CONFIG_DIFFTEST_REF_PATH))
 DIFF_REF_SO = $(DIFF_REF_PATH)/build/$(GUEST_ISA)-$(call remove_quote,$(CONFIG_DIFFTEST_REF_NAME))-so
 MKFLAGS = GUEST_ISA=$(GUEST_ISA) SHARE=1 ENGINE=interpreter
 ARGS_DIFF = --diff=$(DIFF_REF_SO)
+# more REFs to check in parallel, e.g. DIFF_EXTRA_REF_SO=/path/to/riscv32-qemu-so
+ARGS_DIFF += $(addprefix --diff=,$(DIFF_EXTRA_REF_SO))
 
 ifndef CONFIG_DIFFTEST_REF_NEMU
 $(DIFF_REF_SO):
@@ -350,6 +350,10 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
   else memcpy(buf, vm.mem + addr, n);
 }
 
+__EXPORT void difftest_pagehash(const paddr_t *addr, int n, uint64_t *hash) {
+  for (int i = 0; i < n; i ++) hash[i] = difftest_hash_page(vm.mem + addr[i]);
+}
+
 __EXPORT void difftest_regcpy(void *r, bool direction) {
   struct kvm_regs *ref = &(vcpu.kvm_run->s.regs.regs);
   x86_CPU_state *x86 = r;
@@ -46,6 +46,7 @@ __EXPORT void difftest_regcpy(void *dut, bool direction) {
   }
 }
 
+// Steps are not batched, see gdb_si().
 __EXPORT void difftest_exec(uint64_t n) {
   while (n --) gdb_si();
 }
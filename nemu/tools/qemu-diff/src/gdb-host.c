@@ -16,6 +16,12 @@
 #include "common.h"
 
 static struct gdb_conn *conn;
+static bool noack = false;
+static bool has_binary_write = true;
+
+// registers are only fetched again after the state has changed
+static union isa_gdb_regs regs_cache;
+static bool regs_valid = false;
 
 bool gdb_connect_qemu(int port) {
   // connect to gdbserver on localhost port 1234
@@ -23,32 +29,94 @@ bool gdb_connect_qemu(int port) {
     usleep(1);
   }
 
+  // without acks, each exchange is a single packet in each direction
+  noack = (gdb_start_noack(conn)[0] != '\0');
   return true;
 }
 
+static bool recv_ok() {
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = !strcmp((const char*)reply, "OK");
+  free(reply);
+  return ok;
+}
+
 static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
   char *buf = malloc(len * 2 + 128);
   assert(buf != NULL);
   int p = sprintf(buf, "M0x%x,%x:", dest, len);
   int i;
   for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+    buf[p ++] = hex_encode(((uint8_t *)src)[i] >> 4);
+    buf[p ++] = hex_encode(((uint8_t *)src)[i] & 0xf);
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  gdb_send(conn, (const uint8_t *)buf, p);
   free(buf);
 
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
+  return recv_ok();
+}
 
-  return ok;
+// QEMU accepts packets of up to 4096 bytes, and escaping at most doubles a chunk
+#define BINARY_CHUNK 2000
+// number of binary writes sent before their replies are read
+#define WRITE_WINDOW 32
+
+static void send_binary(uint32_t dest, uint8_t *src, int len) {
+  static char buf[BINARY_CHUNK * 2 + 128];
+  int p = sprintf(buf, "X%x,%x:", dest, len);
+  int i;
+  for (i = 0; i < len; i ++) {
+    uint8_t c = src[i];
+    if (c == '#' || c == '$' || c == '}' || c == '*') {
+      buf[p ++] = '}';
+      c ^= 0x20;
+    }
+    buf[p ++] = c;
+  }
+  gdb_send(conn, (const uint8_t *)buf, p);
 }
 
-bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
+bool gdb_memcpy_to_qemu(uint32_t dest, void *buf, int len) {
+  uint8_t *src = buf;
   bool ok = true;
+  if (has_binary_write && len > 0) {
+    // an empty reply to the first write means 'X' is not supported
+    int n = (len < BINARY_CHUNK ? len : BINARY_CHUNK);
+    send_binary(dest, src, n);
+    size_t size;
+    uint8_t *reply = gdb_recv(conn, &size);
+    if (size == 0) has_binary_write = false;
+    else {
+      ok &= !strcmp((const char*)reply, "OK");
+      dest += n;
+      src += n;
+      len -= n;
+    }
+    free(reply);
+  }
+
+  if (has_binary_write) {
+    // the CPU is stopped, so writes can be pipelined when there are no acks
+    int inflight = 0;
+    while (len > 0) {
+      int n = (len < BINARY_CHUNK ? len : BINARY_CHUNK);
+      send_binary(dest, src, n);
+      dest += n;
+      src += n;
+      len -= n;
+      inflight ++;
+      if (!noack || inflight == WRITE_WINDOW) {
+        ok &= recv_ok();
+        inflight --;
+      }
+    }
+    while (inflight -- > 0) ok &= recv_ok();
+    return ok;
+  }
+
+  const int mtu = 1500;
   while (len > mtu) {
     ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
     dest += mtu;
@@ -60,6 +128,10 @@ bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
 }
 
 bool gdb_getregs(union isa_gdb_regs *r) {
+  if (regs_valid) {
+    *r = regs_cache;
+    return true;
+  }
   gdb_send(conn, (const uint8_t *)"g", 1);
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
@@ -77,6 +149,8 @@ bool gdb_getregs(union isa_gdb_regs *r) {
 
   free(reply);
 
+  regs_cache = *r;
+  regs_valid = true;
   return true;
 }
 
@@ -90,21 +164,23 @@ bool gdb_setregs(union isa_gdb_regs *r) {
   int p = 1;
   int i;
   for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+    buf[p ++] = hex_encode(((uint8_t *)src)[i] >> 4);
+    buf[p ++] = hex_encode(((uint8_t *)src)[i] & 0xf);
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  gdb_send(conn, (const uint8_t *)buf, p);
   free(buf);
 
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
-
+  bool ok = recv_ok();
+  regs_cache = *r;
+  regs_valid = ok;
   return ok;
 }
 
+// QEMU stops the CPU when it receives anything while running,
+// so the next request can only be sent after the stop reply.
 bool gdb_si() {
+  regs_valid = false;
   char buf[] = "vCont;s:1";
   gdb_send(conn, (const uint8_t *)buf, strlen(buf));
   size_t size;
@@ -70,11 +70,24 @@ void sim_t::diff_set_regs(void* diff_context) {
   state->pc = ctx->pc;
 }
 
+// Memory is accessed in the backing store directly, a page at a time,
+// instead of one byte at a time through the MMU.
+static mem_t* diff_mem(reg_t addr, size_t n) {
+  mem_t *mem = difftest_mem[0].second;
+  assert(addr >= DRAM_BASE && addr - DRAM_BASE + n <= mem->size());
+  return mem;
+}
+
 void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
-  mmu_t* mmu = p->get_mmu();
-  for (size_t i = 0; i < n; i++) {
-    mmu->store<uint8_t>(dest+i, *((uint8_t*)src+i));
-  }
+  bool ok = diff_mem(dest, n)->store(dest - DRAM_BASE, n, (const uint8_t *)src);
+  assert(ok);
+  // the code may have been overwritten
+  p->get_mmu()->flush_icache();
+}
+
+static void diff_memread(reg_t src, void* dest, size_t n) {
+  bool ok = diff_mem(src, n)->load(src - DRAM_BASE, n, (uint8_t *)dest);
+  assert(ok);
 }
 
 extern "C" {
@@ -83,7 +96,13 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    diff_memread(addr, buf, n);
+  }
+}
+
+__EXPORT void difftest_pagehash(const paddr_t *addr, int n, uint64_t *hash) {
+  for (int i = 0; i < n; i++) {
+    hash[i] = difftest_hash_page(diff_mem(addr[i], DIFFTEST_PAGE_SIZE)->contents(addr[i] - DRAM_BASE));
   }
 }
 